@@ -7,11 +7,48 @@
 #include <magic_enum/magic_enum.hpp>
 
 #include <variant>
+#include <array>
+#include <tuple>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <limits>
 #include <map>
+#include <memory_resource>
+#include <vector>
 #include <unordered_map>
 #include <optional>
+#include <span>
 #include <string_view>
 #include <type_traits>
+#if __has_include(<format>)
+#include <format>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JZ_HAS_POSIX_SINKS 1
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 
 namespace jz {
 template<class T>
@@ -34,8 +71,8 @@ concept LikeVec = requires(T vec, size_t n) {
 
 template<class T>
 struct IsStr : std::false_type {};
-template<>
-struct IsStr<std::string> : std::true_type {};
+template<class Traits, class Alloc>
+struct IsStr<std::basic_string<char, Traits, Alloc>> : std::true_type {};
 template<>
 struct IsStr<std::string_view> : std::true_type {};
 template<size_t N>
@@ -163,12 +200,20 @@ struct MemberInfoCreator<member> {
 template<class T, class GetMemberFuncT, auto memberName, bool isBitField>
 struct MemberGetter {
     using ClassType                   = T;
-    using MemberType                  = std::invoke_result_t<GetMemberFuncT, T const &>;
     static constexpr auto name        = memberName;
     static constexpr bool IS_BITFIELD = isBitField;
 
+    //! getter may take std::pmr::memory_resource * as 2nd argument to allocate its result, e.g. a std::pmr::string.
+    static constexpr bool WITH_RESOURCE = std::is_invocable_v<GetMemberFuncT, T const &, std::pmr::memory_resource *>;
+    using MemberType                    = typename std::conditional_t<WITH_RESOURCE,
+                                                                      std::invoke_result<GetMemberFuncT, T const &, std::pmr::memory_resource *>,
+                                                                      std::invoke_result<GetMemberFuncT, T const &>>::type;
+
     static constexpr std::string_view getName() { return name.view(); }
-    static constexpr MemberType       getMember(T const &obj) { return GetMemberFuncT{}(obj); }
+    static constexpr MemberType       getMember(T const &obj, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+        if constexpr (WITH_RESOURCE) return GetMemberFuncT{}(obj, resource);
+        else return GetMemberFuncT{}(obj);
+    }
 };
 
 template<class T>
@@ -213,6 +258,15 @@ constexpr auto make_struct_members() {
 template<class T>
 struct FormatStructTrait;
 
+//! index of the member named name in the tuple of members, or tuple size if not found.
+template<class... Members>
+constexpr size_t findMemberByName(std::tuple<Members...> const &, std::string_view name) {
+    constexpr std::string_view names[] = {Members::getName()..., {}};
+    for (size_t i = 0; i < sizeof...(Members); ++i)
+        if (names[i] == name) return i;
+    return sizeof...(Members);
+}
+
 template<class T, class = void>
 static constexpr bool HasOverrideMemberAccessors = false;
 
@@ -220,26 +274,1412 @@ template<class T>
 static constexpr bool HasOverrideMemberAccessors<T, std::void_t<decltype(jz::FormatStructTrait<T>::OverrideMemberAccessors())>> = true;
 
 
+//! number of decimal digits of v.
+inline constexpr uint32_t countDigits(uint64_t v) {
+    uint32_t n = 1;
+    for (; v >= 10000; v /= 10000) n += 4;
+    return n + (v >= 10) + (v >= 100) + (v >= 1000);
+}
+
+//! "00".."99", two chars per entry.
+inline constexpr char DIGIT_PAIRS[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                      "8081828384858687888990919293949596979899";
+
+//! max chars of a decimal integer up to 64 bits.
+inline constexpr size_t MAX_INTEGER_CHARS = 20;
+
+//! chars of decimal val, including the sign.
+template<class I>
+constexpr uint32_t decimalSize(I val) {
+    if constexpr (std::is_signed_v<I>) {
+        if (val < 0) return 1 + countDigits(uint64_t(0) - uint64_t(val));
+    }
+    return countDigits(uint64_t(val));
+}
+
+//! writes decimal val at out two digits at a time, without locale; size is decimalSize(val). Returns the end. Integers up to 64 bits.
+template<class I>
+char *formatDecimal(char *out, I val, uint32_t size) {
+    static_assert(std::is_integral_v<I> && sizeof(I) <= 8);
+    uint64_t u = uint64_t(val);
+    if constexpr (std::is_signed_v<I>) {
+        if (val < 0) {
+            *out = '-';
+            u    = uint64_t(0) - u;
+        }
+    }
+    char *end = out + size, *p = end;
+    for (; u >= 100; u /= 100) std::memcpy(p -= 2, DIGIT_PAIRS + (u % 100) * 2, 2);
+    if (u >= 10) std::memcpy(p - 2, DIGIT_PAIRS + u * 2, 2);
+    else p[-1] = char('0' + u);
+    return end;
+}
+
+template<class I>
+char *formatDecimal(char *out, I val) {
+    return formatDecimal(out, val, decimalSize(val));
+}
+
+/// Fixed-point decimal, i.e. value scaled by 10^SCALE, e.g. Decimal<4>{1012500} prints 101.2500.
+/// Getters could return it instead of building strings of prices.
+template<uint32_t Scale, class I = int64_t>
+struct Decimal {
+    static_assert(std::is_integral_v<I> && sizeof(I) > 1 && sizeof(I) <= 8 && Scale <= 19);
+    using Rep                       = I;
+    static constexpr uint32_t SCALE = Scale;
+
+    I value;
+};
+template<class T>
+struct IsDecimal : std::false_type {};
+template<uint32_t Scale, class I>
+struct IsDecimal<Decimal<Scale, I>> : std::true_type {};
+
+//! chars of val scaled by 10^scale, including the sign and the point.
+template<class I>
+constexpr uint32_t scaledSize(I val, uint32_t scale) {
+    uint32_t size = decimalSize(val), sign = 0;
+    if constexpr (std::is_signed_v<I>) sign = val < 0;
+    return sign + std::max(size - sign, scale + 1) + (scale > 0);
+}
+
+//! writes val scaled by 10^scale with integer math, all scale digits after the point, e.g. -5 with scale 3 is -0.005. Returns the end.
+template<class I>
+char *formatScaled(char *out, I val, uint32_t scale) {
+    char    *end = out + scaledSize(val, scale), *p = end;
+    uint64_t u   = uint64_t(val);
+    if constexpr (std::is_signed_v<I>) {
+        if (val < 0) {
+            *out++ = '-';
+            u      = uint64_t(0) - u;
+        }
+    }
+    uint32_t i = 0;
+    for (; i + 2 <= scale; i += 2, u /= 100) std::memcpy(p -= 2, DIGIT_PAIRS + (u % 100) * 2, 2);
+    if (i < scale) *--p = char('0' + u % 10), u /= 10;
+    if (scale) *--p = '.';
+    formatDecimal(out, u, uint32_t(p - out));
+    return end;
+}
+
+/// Base of the output sinks that format_struct writes into without iostream machinery (no sentry, locale or flags).
+/// Derived implements append(const char *, size_t), and may hide appendInteger to render integers differently.
+/// A Derived with contiguous storage implements prepare(n), returning room for n chars, and commit(n), so integers are written in place.
+/// Numbers are rendered without locale the same way as the default std::ostream.
+template<class Derived>
+struct FormatSink {
+    Derived &operator<<(char c) {
+        self().append(&c, 1);
+        return self();
+    }
+    Derived &operator<<(signed char c) { return *this << char(c); }
+    Derived &operator<<(unsigned char c) { return *this << char(c); }
+    Derived &operator<<(bool b) { return *this << (b ? '1' : '0'); }
+    Derived &operator<<(const char *s) { return *this << std::string_view(s); }
+    Derived &operator<<(std::string_view s) {
+        self().append(s.data(), s.size());
+        return self();
+    }
+
+    template<class I>
+        requires std::is_integral_v<I>
+    Derived &operator<<(I val) {
+        self().appendInteger(val);
+        return self();
+    }
+    template<class F>
+        requires std::is_floating_point_v<F>
+    Derived &operator<<(F val) {
+        char buf[64]; // same as ostream default: %g with 6 significant digits.
+        auto res = std::to_chars(buf, buf + sizeof(buf), val, std::chars_format::general, 6);
+        self().append(buf, res.ptr - buf);
+        return self();
+    }
+
+    template<class I>
+    void appendInteger(I val) {
+        if constexpr (sizeof(I) > 8) {
+            char buf[48];
+            auto res = std::to_chars(buf, buf + sizeof(buf), val);
+            self().append(buf, res.ptr - buf);
+        } else if constexpr (requires { self().prepare(size_t(1)); }) {
+            uint32_t size = decimalSize(val);
+            formatDecimal(self().prepare(size), val, size);
+            self().commit(size);
+        } else {
+            char buf[MAX_INTEGER_CHARS];
+            self().append(buf, formatDecimal(buf, val) - buf);
+        }
+    }
+
+private:
+    Derived &self() { return static_cast<Derived &>(*this); }
+};
+
+/// Sink that only counts bytes.
+struct CountingSink : FormatSink<CountingSink> {
+    size_t                     count          = 0;
+    std::pmr::memory_resource *memoryResource = std::pmr::get_default_resource(); // for getters.
+
+    std::pmr::memory_resource *resource() const { return memoryResource; }
+
+    void append(const char *, size_t n) { count += n; }
+    template<class I>
+    void appendInteger(I val) {
+        count += decimalSize(val);
+    }
+};
+
+/// Growable contiguous byte buffer. Storage grows geometrically and the content is moved out by str() && without copy.
+/// StringT is a contiguous resizable char container, e.g. std::string.
+template<class StringT = std::string>
+class BasicFormatBuffer : public FormatSink<BasicFormatBuffer<StringT>> {
+    StringT m_data;     // m_data.size() is the capacity in use; bytes after m_size are scratch.
+    size_t  m_size = 0; // bytes written.
+
+public:
+    static constexpr size_t INITIAL_CAPACITY = 128;
+
+    BasicFormatBuffer() = default;
+    //! adopts storage and appends after its content, using the capacity already there.
+    explicit BasicFormatBuffer(StringT storage) : m_data(std::move(storage)), m_size(m_data.size()) {}
+
+    void append(const char *s, size_t n) {
+        if (!n) return; // an empty string_view may carry a null s, which memcpy must not get.
+        if (m_size + n > m_data.size()) grow(n);
+        std::memcpy(m_data.data() + m_size, s, n);
+        m_size += n;
+    }
+    void push_back(char c) { append(&c, 1); }
+    char *prepare(size_t n) {
+        if (m_size + n > m_data.size()) grow(n);
+        return m_data.data() + m_size;
+    }
+    void commit(size_t n) { m_size += n; }
+    void reserve(size_t n) {
+        if (n > m_data.size()) m_data.resize(n);
+    }
+    void clear() { m_size = 0; }
+
+    size_t           size() const { return m_size; }
+    const char      *data() const { return m_data.data(); }
+    //! memory resource of a std::pmr storage, which getters allocate from.
+    std::pmr::memory_resource *resource() const
+        requires requires(StringT const &d) { d.get_allocator().resource(); }
+    {
+        return m_data.get_allocator().resource();
+    }
+    std::string_view view() const { return std::string_view(m_data.data(), m_size); }
+
+    StringT str() const & { return StringT(m_data.data(), m_data.data() + m_size, m_data.get_allocator()); }
+    StringT str() && {
+        m_data.resize(m_size);
+        m_size = 0;
+        return std::move(m_data);
+    }
+
+private:
+    void grow(size_t n) {
+        size_t newSize = std::max({m_data.size() * 2, m_size + n, INITIAL_CAPACITY});
+        if (m_size + n <= m_data.capacity()) newSize = std::min(newSize, size_t(m_data.capacity())); // no reallocation
+        m_data.resize(newSize);
+    }
+};
+using FormatBuffer = BasicFormatBuffer<std::string>;
+
+/// String with N bytes of inline storage, which only spills to heap when the content overflows.
+/// It's also a sink, so short formatted structs stay on the stack.
+template<size_t N>
+class FormattedString : public FormatSink<FormattedString<N>> {
+    char   m_inline[N];
+    char  *m_data = m_inline;
+    size_t m_size = 0;
+    size_t m_cap  = N;
+
+public:
+    FormattedString() = default;
+    FormattedString(FormattedString const &other) { append(other.m_data, other.m_size); }
+    FormattedString(FormattedString &&other) noexcept { moveFrom(other); }
+    FormattedString &operator=(FormattedString const &other) {
+        if (this != &other) {
+            clear();
+            append(other.m_data, other.m_size);
+        }
+        return *this;
+    }
+    FormattedString &operator=(FormattedString &&other) noexcept {
+        if (this != &other) {
+            release();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    ~FormattedString() { release(); }
+
+    void append(const char *s, size_t n) {
+        if (!n) return;
+        if (m_size + n > m_cap) grow(n);
+        std::memcpy(m_data + m_size, s, n);
+        m_size += n;
+    }
+    char *prepare(size_t n) {
+        if (m_size + n > m_cap) grow(n);
+        return m_data + m_size;
+    }
+    void commit(size_t n) { m_size += n; }
+    void clear() { m_size = 0; }
+
+    bool             isInline() const { return m_data == m_inline; }
+    size_t           size() const { return m_size; }
+    const char      *data() const { return m_data; }
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+    std::string      str() const { return std::string(m_data, m_size); }
+    operator std::string_view() const { return view(); }
+
+    friend std::ostream &operator<<(std::ostream &os, FormattedString const &str) { return os << str.view(); }
+
+private:
+    void moveFrom(FormattedString &other) {
+        if (other.isInline()) {
+            append(other.m_data, other.m_size);
+        } else {
+            m_data       = other.m_data;
+            m_cap        = other.m_cap;
+            m_size       = other.m_size;
+            other.m_data = other.m_inline;
+            other.m_cap  = N;
+        }
+        other.m_size = 0;
+    }
+    void release() {
+        if (!isInline()) delete[] m_data;
+        m_data = m_inline;
+        m_cap  = N;
+        m_size = 0;
+    }
+    void grow(size_t n) {
+        size_t cap  = std::max(m_cap * 2, m_size + n);
+        char  *data = new char[cap];
+        std::memcpy(data, m_data, m_size);
+        if (!isInline()) delete[] m_data;
+        m_data = data;
+        m_cap  = cap;
+    }
+};
+
+/// Thread-local cache of warmed std::string buffers. At most MAX_POOLED buffers are kept per thread,
+/// and buffers larger than MAX_POOLED_CAPACITY are freed instead of kept.
+struct StringPool {
+    static constexpr size_t MAX_POOLED          = 8;
+    static constexpr size_t MAX_POOLED_CAPACITY = 64 << 10;
+
+    //! an empty string, with pooled capacity if any.
+    static std::string acquire() {
+        auto &pool = buffers();
+        if (pool.empty()) return {};
+        std::string res = std::move(pool.back());
+        pool.pop_back();
+        res.clear();
+        return res;
+    }
+    static void release(std::string &&str) {
+        if (str.capacity() <= std::string().capacity() || str.capacity() > MAX_POOLED_CAPACITY) return;
+        auto &pool = buffers();
+        if (pool.size() < MAX_POOLED) pool.push_back(std::move(str));
+    }
+    static size_t pooled() { return buffers().size(); }
+
+private:
+    static std::vector<std::string> &buffers() {
+        thread_local std::vector<std::string> pool = [] {
+            std::vector<std::string> res;
+            res.reserve(MAX_POOLED);
+            return res;
+        }();
+        return pool;
+    }
+};
+
+/// Formatted string whose buffer goes back to the thread-local StringPool on destruction.
+/// It must not outlive the thread, e.g. as a static object.
+class PooledString {
+    std::string m_str;
+
+public:
+    explicit PooledString(std::string &&str) : m_str(std::move(str)) {}
+    PooledString(PooledString &&)            = default;
+    PooledString &operator=(PooledString &&) = default;
+    ~PooledString() { StringPool::release(std::move(m_str)); }
+
+    std::string const &str() const { return m_str; }
+    std::string_view   view() const { return m_str; }
+    const char        *c_str() const { return m_str.c_str(); }
+    size_t             size() const { return m_str.size(); }
+    operator std::string_view() const { return m_str; }
+
+    friend std::ostream &operator<<(std::ostream &os, PooledString const &str) { return os << str.m_str; }
+};
+
+/// Sink over caller-provided storage which never allocates. Space for closing every open brace and bracket is reserved when it's opened.
+/// When the output doesn't fit, it rolls back to the last item boundary, stops the traversal and only writes the pending closers.
+/// The result is not null-terminated.
+class FixedBufferSink : public FormatSink<FixedBufferSink> {
+    char   *m_buf;
+    size_t  m_cap;
+    size_t  m_size       = 0;
+    size_t  m_reserved   = 0; // bytes reserved for closers of open scopes.
+    size_t  m_itemStart  = 0; // rollback point on truncation.
+    int32_t m_deadScopes = 0; // scopes opened after truncation, which are not printed.
+    bool    m_truncated  = false;
+
+public:
+    FixedBufferSink(char *buf, size_t cap) : m_buf(buf), m_cap(cap) {}
+
+    void append(const char *s, size_t n) {
+        if (m_truncated || !n) return;
+        if (m_size + n + m_reserved > m_cap) return truncate();
+        std::memcpy(m_buf + m_size, s, n);
+        m_size += n;
+    }
+    void openScope(std::string_view opener, std::string_view closer) {
+        if (!m_truncated && m_size + opener.size() + closer.size() + m_reserved > m_cap) truncate();
+        if (m_truncated) {
+            ++m_deadScopes;
+            return;
+        }
+        append(opener.data(), opener.size());
+        m_reserved += closer.size();
+    }
+    void closeScope(std::string_view closer) {
+        if (m_deadScopes) {
+            --m_deadScopes;
+            return;
+        }
+        m_reserved -= closer.size();
+        std::memcpy(m_buf + m_size, closer.data(), closer.size());
+        m_size += closer.size();
+    }
+    bool nextItem() {
+        m_itemStart = m_size;
+        return !m_truncated;
+    }
+
+    size_t size() const { return m_size; }
+    bool   truncated() const { return m_truncated; }
+
+private:
+    void truncate() {
+        m_truncated = true;
+        m_size      = m_itemStart;
+    }
+};
+
+/// Sink owning a fixed-size buffer, which is handed to callback as a chunk whenever it fills, e.g. as a network frame or a pipe write.
+/// Callback is bool(std::string_view chunk) and returns false to stop. The remaining output is then dropped and format_struct
+/// stops at the next member or element, so a slow consumer bounds memory. Call flush() to hand out the last partial chunk.
+template<class Callback>
+class ChunkedSink : public FormatSink<ChunkedSink<Callback>> {
+    Callback                m_callback;
+    std::unique_ptr<char[]> m_buf;
+    size_t                  m_cap;
+    size_t                  m_size    = 0;
+    bool                    m_stopped = false;
+
+public:
+    ChunkedSink(size_t chunkSize, Callback callback)
+        : m_callback(std::move(callback)), m_buf(std::make_unique<char[]>(std::max<size_t>(chunkSize, 1))), m_cap(std::max<size_t>(chunkSize, 1)) {}
+
+    void append(const char *s, size_t n) {
+        if (!n) return;
+        while (n && !m_stopped) {
+            size_t k = std::min(n, m_cap - m_size);
+            std::memcpy(m_buf.get() + m_size, s, k);
+            m_size += k;
+            s += k;
+            n -= k;
+            if (m_size == m_cap) emit();
+        }
+    }
+    bool nextItem() const { return !m_stopped; }
+
+    //! hands out pending output. Returns false if callback stopped.
+    bool flush() {
+        if (m_size && !m_stopped) emit();
+        return !m_stopped;
+    }
+    bool stopped() const { return m_stopped; }
+
+private:
+    void emit() {
+        m_stopped = !m_callback(std::string_view(m_buf.get(), m_size));
+        m_size    = 0;
+    }
+};
+
+/// Sink writing through a plain output iterator, e.g. std::back_insert_iterator or char *.
+template<class OutputIt>
+struct OutputIteratorSink : FormatSink<OutputIteratorSink<OutputIt>> {
+    OutputIt out;
+
+    explicit OutputIteratorSink(OutputIt pout) : out(std::move(pout)) {}
+    void append(const char *s, size_t n) { out = std::copy_n(s, n, std::move(out)); }
+};
+
+#ifdef JZ_HAS_POSIX_SINKS
+/// Scatter-gather sink for writev(2). String bodies passed by appendRef are referenced instead of copied, and everything else,
+/// i.e. delimiters, keys, numbers and short strings, is coalesced into a side arena since an iovec entry costs more than copying a few bytes.
+/// Referenced strings must stay unchanged until flush(), which is called when the iovec array or the arena is full, and on destruction.
+class IovecSink : public FormatSink<IovecSink> {
+    int               m_fd;
+    std::vector<char> m_arena;
+    size_t            m_arenaUsed = 0;
+    iovec             m_iov[IOV_MAX < 256 ? IOV_MAX : 256];
+    int               m_iovCount  = 0;
+    int32_t           m_transient = 0; // inside a value that dies after formatting, which is always copied.
+    int               m_error     = 0;
+
+public:
+    static constexpr size_t MIN_REF_SIZE = 64; // shorter strings are copied.
+
+    explicit IovecSink(int fd, size_t arenaSize = 8192) : m_fd(fd), m_arena(arenaSize) {}
+    IovecSink(IovecSink const &)            = delete;
+    IovecSink &operator=(IovecSink const &) = delete;
+    ~IovecSink() { flush(); }
+
+    void append(const char *s, size_t n) {
+        if (!n) return;
+        // flush before copying: a flush from pushIov would reset the arena under the new iovec.
+        if (m_arenaUsed + n > m_arena.size() || m_iovCount == int(std::size(m_iov))) {
+            flush();
+            if (n > m_arena.size()) { // too large for arena, write it out while it's alive.
+                pushIov(s, n);
+                flush();
+                return;
+            }
+        }
+        char *dst = m_arena.data() + m_arenaUsed;
+        std::memcpy(dst, s, n);
+        m_arenaUsed += n;
+        if (m_iovCount && static_cast<char *>(m_iov[m_iovCount - 1].iov_base) + m_iov[m_iovCount - 1].iov_len == dst) {
+            m_iov[m_iovCount - 1].iov_len += n;
+        } else {
+            pushIov(dst, n);
+        }
+    }
+    void appendRef(std::string_view s) {
+        if (m_transient || s.size() < MIN_REF_SIZE) return append(s.data(), s.size());
+        pushIov(s.data(), s.size());
+    }
+    void beginTransient() { ++m_transient; }
+    void endTransient() { --m_transient; }
+
+    //! writes out all pending iovecs. Returns false and keeps errno in error() on failure.
+    bool flush() {
+        iovec *iov = m_iov;
+        int    cnt = m_iovCount;
+        while (cnt > 0 && !m_error) {
+            ssize_t n = ::writev(m_fd, iov, cnt);
+            if (n < 0) {
+                if (errno != EINTR) m_error = errno;
+                continue;
+            }
+            for (; cnt > 0 && size_t(n) >= iov->iov_len; --cnt) n -= (iov++)->iov_len;
+            if (cnt > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+        m_iovCount  = 0;
+        m_arenaUsed = 0;
+        return !m_error;
+    }
+    int error() const { return m_error; }
+
+private:
+    void pushIov(const char *s, size_t n) {
+        if (m_iovCount == int(std::size(m_iov))) flush();
+        m_iov[m_iovCount++] = iovec{const_cast<char *>(s), n};
+    }
+};
+
+/// File descriptor sink with N fixed-size buffers. The caller formats into one buffer while a background thread writes
+/// the filled ones with write(2) in order. The caller only blocks when all other buffers are still being written.
+/// flush() waits until everything is written; close() also stops the background thread. The fd is not closed.
+class FdSink : public FormatSink<FdSink> {
+    struct Buffer {
+        std::unique_ptr<char[]> data;
+        size_t                  size = 0;
+    };
+    int                     m_fd;
+    size_t                  m_bufSize;
+    std::vector<Buffer>     m_buffers;
+    Buffer                 *m_curr;
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_cond;
+    size_t                  m_submitted = 0; // number of buffers handed to writer.
+    size_t                  m_written   = 0; // number of buffers written.
+    bool                    m_stop      = false;
+    bool                    m_closed    = false; // only touched by the caller's thread.
+    int                     m_error     = 0;
+    std::thread             m_writer;
+
+public:
+    explicit FdSink(int fd, size_t bufSize = 1 << 20, size_t numBuffers = 2)
+        : m_fd(fd), m_bufSize(std::max<size_t>(bufSize, 1)), m_buffers(std::max<size_t>(numBuffers, 2)) {
+        for (auto &buf : m_buffers) buf.data = std::make_unique<char[]>(m_bufSize);
+        m_curr   = &m_buffers[0];
+        m_writer = std::thread([this] { writeLoop(); });
+    }
+    FdSink(FdSink const &)            = delete;
+    FdSink &operator=(FdSink const &) = delete;
+    ~FdSink() { close(); }
+
+    void append(const char *s, size_t n) {
+        if (m_closed || !n) return; // no writer left to free a buffer.
+        while (n) {
+            size_t k = std::min(n, m_bufSize - m_curr->size);
+            std::memcpy(m_curr->data.get() + m_curr->size, s, k);
+            m_curr->size += k;
+            s += k;
+            n -= k;
+            if (m_curr->size == m_bufSize) submit();
+        }
+    }
+
+    //! waits until all formatted output is written. Returns false and keeps errno in error() on failure.
+    bool flush() {
+        if (m_curr->size) submit();
+        std::unique_lock lock(m_mutex);
+        m_cond.wait(lock, [this] { return m_written == m_submitted; });
+        return !m_error;
+    }
+    //! flushes and stops the background writer. No more output is accepted, i.e. later appends are dropped.
+    bool close() {
+        if (!m_writer.joinable()) return !error();
+        bool ok = flush();
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_writer.join();
+        m_closed = true;
+        return ok;
+    }
+    int error() const {
+        std::lock_guard lock(m_mutex);
+        return m_error;
+    }
+
+private:
+    //! hands current buffer to writer and waits for next buffer to be free.
+    void submit() {
+        std::unique_lock lock(m_mutex);
+        ++m_submitted;
+        m_cond.notify_all();
+        m_cond.wait(lock, [this] { return m_submitted - m_written < m_buffers.size(); });
+        m_curr       = &m_buffers[m_submitted % m_buffers.size()];
+        m_curr->size = 0;
+    }
+    void writeLoop() {
+        std::unique_lock lock(m_mutex);
+        while (true) {
+            m_cond.wait(lock, [this] { return m_stop || m_written != m_submitted; });
+            if (m_written == m_submitted) return; // stopped
+            Buffer &buf = m_buffers[m_written % m_buffers.size()];
+            lock.unlock();
+            int err = m_error ? m_error : writeAll(buf.data.get(), buf.size);
+            lock.lock();
+            m_error = err;
+            ++m_written;
+            m_cond.notify_all();
+        }
+    }
+    int writeAll(const char *s, size_t n) {
+        while (n) {
+            ssize_t k = ::write(m_fd, s, n);
+            if (k < 0) {
+                if (errno == EINTR) continue;
+                return errno;
+            }
+            s += k;
+            n -= k;
+        }
+        return 0;
+    }
+};
+
+/// Sink formatting straight into a memory-mapped output file. The file is extended and mapped one window at a time,
+/// remapped when the window is full and truncated to the written size on close(). The page cache does the write-back.
+/// Like any shared mapping of a sparse file, running out of disk space raises SIGBUS.
+class MmapSink : public FormatSink<MmapSink> {
+    int    m_fd = -1;
+    size_t m_window; // bytes mapped at a time, multiple of page size.
+    char  *m_map    = nullptr;
+    size_t m_offset = 0; // file offset of m_map.
+    size_t m_pos    = 0; // bytes written in m_map.
+    int    m_error  = 0;
+
+public:
+    //! creates or truncates the file at path.
+    explicit MmapSink(const char *path, size_t window = 64 << 20) {
+        size_t page = ::sysconf(_SC_PAGESIZE);
+        m_window    = std::max<size_t>((window + page - 1) / page, 1) * page;
+        m_offset    = -m_window; // unsigned wraps, so the first write maps offset 0 and size() is 0.
+        m_pos       = m_window;
+        m_fd        = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0) m_error = errno;
+    }
+    MmapSink(MmapSink const &)            = delete;
+    MmapSink &operator=(MmapSink const &) = delete;
+    ~MmapSink() { close(); }
+
+    void append(const char *s, size_t n) {
+        if (m_fd < 0) return; // closed, or the open failed.
+        while (n) {
+            if (m_pos == m_window && !remap()) return;
+            size_t k = std::min(n, m_window - m_pos);
+            std::memcpy(m_map + m_pos, s, k);
+            m_pos += k;
+            s += k;
+            n -= k;
+        }
+    }
+
+    //! unmaps and truncates the file to the written size, later appends are dropped.
+    //! Returns false and keeps errno in error() on failure.
+    bool close() {
+        if (m_fd < 0) return !m_error;
+        if (m_map) ::munmap(m_map, m_window);
+        m_map = nullptr;
+        if (::ftruncate(m_fd, size()) != 0 && !m_error) m_error = errno;
+        ::close(m_fd);
+        m_fd = -1;
+        return !m_error;
+    }
+    size_t size() const { return m_offset + m_pos; }
+    int    error() const { return m_error; }
+
+private:
+    bool remap() {
+        if (m_error) return false;
+        if (m_map) ::munmap(m_map, m_window);
+        m_map = nullptr;
+        size_t offset = m_offset + m_window;
+        void  *p      = MAP_FAILED;
+        if (::ftruncate(m_fd, offset + m_window) == 0) p = ::mmap(nullptr, m_window, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+        if (p == MAP_FAILED) {
+            m_error = errno;
+            return false;
+        }
+        m_map    = static_cast<char *>(p);
+        m_offset = offset;
+        m_pos    = 0;
+        return true;
+    }
+};
+#endif
+
+/// Runtime configurable grammar. Delimiters are views, so the strings assigned to them must outlive the grammar.
 struct FormatterGrammar {
-    std::string kvBegin = " { ";
-    std::string kvEnd   = " } ";
-    std::string kvDelim = " , ";
-    std::string kvSep   = " : ";
+    std::string_view kvBegin = " { ";
+    std::string_view kvEnd   = " } ";
+    std::string_view kvDelim = " , ";
+    std::string_view kvSep   = " : ";
 
-    std::string vecBegin = " [ ";
-    std::string vecEnd   = " ] ";
-    std::string vecDelim = " , ";
+    std::string_view vecBegin = " [ ";
+    std::string_view vecEnd   = " ] ";
+    std::string_view vecDelim = " , ";
 
     bool quotedKey          = true;
     bool quotedVal          = true;
     bool ignoreZeroBitField = true; // don't print bitfield field if the value is 0.
+    bool escapeStrings      = true; // JSON-escape quoted strings and keys.
+};
+
+//! Optional sink hooks. A sink may implement openScope/closeScope to track open braces and brackets,
+//! and nextItem, which is called before each member or element, to mark item boundaries and return false to stop the traversal.
+template<class OSTREAM>
+void sinkOpenScope(OSTREAM &os, std::string_view opener, std::string_view closer) {
+    if constexpr (requires { os.openScope(opener, closer); }) os.openScope(opener, closer);
+    else os << opener;
+}
+template<class OSTREAM>
+void sinkCloseScope(OSTREAM &os, std::string_view closer) {
+    if constexpr (requires { os.closeScope(closer); }) os.closeScope(closer);
+    else os << closer;
+}
+template<class OSTREAM>
+bool sinkNextItem(OSTREAM &os) {
+    if constexpr (requires { os.nextItem(); }) return os.nextItem();
+    else return true;
+}
+//! s is the body of a string that outlives the formatting call, which a sink may reference by appendRef instead of copying.
+template<class OSTREAM>
+void sinkAppendRef(OSTREAM &os, std::string_view s) {
+    if constexpr (requires { os.appendRef(s); }) os.appendRef(s);
+    else os << s;
+}
+//! writes integer val. std::ostream skips num_put and locale, i.e. ignores stream flags, sinks write in place.
+//! 1-byte integers other than char and bool, e.g. uint8_t bitfields, are numbers too.
+template<class OSTREAM, class I>
+void writeInteger(OSTREAM &os, I val) {
+    if constexpr (std::is_integral_v<I> && sizeof(I) == 1 && !std::is_same_v<I, char> && !std::is_same_v<I, bool>) {
+        writeInteger(os, std::conditional_t<std::is_signed_v<I>, int32_t, uint32_t>(val));
+    } else if constexpr (std::is_base_of_v<std::ostream, OSTREAM> && std::is_integral_v<I> && sizeof(I) > 1 && sizeof(I) <= 8) {
+        char buf[MAX_INTEGER_CHARS];
+        os.write(buf, formatDecimal(buf, val) - buf);
+    } else {
+        os << val;
+    }
+}
+
+//! integer elements formatted as numbers, which writeIntegers formats in bulk. int8_t and char print as chars.
+template<class T>
+concept BulkInteger = std::is_integral_v<T> && (sizeof(T) > 1 && sizeof(T) <= 8 || std::is_same_v<T, uint8_t>);
+
+//! writes n contiguous integers separated by delim. Digits and delimiters are rendered into a local chunk, one write per chunk.
+template<class OSTREAM, class I>
+void writeIntegers(OSTREAM &os, I const *vals, size_t n, std::string_view delim) {
+    constexpr size_t CHUNK = 1024;
+    char             buf[CHUNK];
+    size_t           pos = 0, itemSize = MAX_INTEGER_CHARS + delim.size();
+    if (itemSize > CHUNK) { // huge delimiter.
+        for (size_t i = 0; i < n; ++i) {
+            if (i) os << delim;
+            writeInteger(os, vals[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (pos + itemSize > CHUNK) {
+            os << std::string_view(buf, pos);
+            pos = 0;
+        }
+        if (i) {
+            std::memcpy(buf + pos, delim.data(), delim.size());
+            pos += delim.size();
+        }
+        pos = formatDecimal(buf + pos, vals[i]) - buf;
+    }
+    if (pos) os << std::string_view(buf, pos);
+}
+
+//! writes size chars rendered by render(char *). Sinks with prepare/commit get them in place, others through a local buffer of MAX chars.
+template<size_t MAX, class OSTREAM, class RenderFn>
+void writeRendered(OSTREAM &os, size_t size, RenderFn &&render) {
+    if constexpr (requires { os.prepare(size_t(1)); }) {
+        render(os.prepare(size));
+        os.commit(size);
+    } else {
+        char buf[MAX];
+        render(buf);
+        os << std::string_view(buf, size);
+    }
+}
+
+//! writes val scaled by 10^scale.
+template<class OSTREAM, class I>
+void writeScaled(OSTREAM &os, I val, uint32_t scale) {
+    writeRendered<MAX_INTEGER_CHARS + 2>(os, scaledSize(val, scale), [&](char *out) { formatScaled(out, val, scale); });
+}
+
+//! "00".."ff", two chars per byte.
+inline constexpr std::array<char, 512> HEX_PAIRS = [] {
+    std::array<char, 512> res{};
+    for (size_t i = 0; i < 256; ++i) {
+        res[i * 2]     = "0123456789abcdef"[i >> 4];
+        res[i * 2 + 1] = "0123456789abcdef"[i & 15];
+    }
+    return res;
+}();
+
+//! JSON escape of each char: 0 if none, 'u' for \u00XX, else the char after the backslash.
+inline constexpr std::array<char, 256> JSON_ESCAPES = [] {
+    std::array<char, 256> res{};
+    for (size_t c = 0; c < 0x20; ++c) res[c] = 'u';
+    res['\b'] = 'b', res['\t'] = 't', res['\n'] = 'n', res['\f'] = 'f', res['\r'] = 'r';
+    res['"'] = '"', res['\\'] = '\\';
+    return res;
+}();
+
+/// What to do with invalid UTF-8 in strings, e.g. from counterparty messages, which JSON consumers reject.
+/// Valid text is checked 16 chars per step with SSSE3. Without it only ASCII runs are, and each multi-byte code point is decoded.
+enum class Utf8Policy : int32_t {
+    Off,       // copy bytes as they are.
+    Replace,   // replace each invalid byte with U+FFFD.
+    HexEscape, // replace each invalid byte with \xHH, whose backslash is escaped when JSON escaping.
 };
 
-template<class UserContext = int>
+//! index of the first char of s which JSON requires to escape when ESCAPE, i.e. '"', '\\' or a control char,
+//! or of the first non-ASCII char when NON_ASCII, or s.size().
+//! Checks 32 or 16 chars per step with AVX2 or SSE2, else one char per table lookup.
+template<bool ESCAPE, bool NON_ASCII>
+size_t findSpecialChar(std::string_view s) {
+    const char *p = s.data(), *end = p + s.size();
+#if defined(__AVX2__)
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\'), control = _mm256_set1_epi8(0x1f);
+    for (; end - p >= 32; p += 32) {
+        __m256i  v    = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        uint32_t mask = NON_ASCII ? uint32_t(_mm256_movemask_epi8(v)) : 0;
+        if constexpr (ESCAPE) {
+            __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                           _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v)); // v <= 0x1f
+            mask |= uint32_t(_mm256_movemask_epi8(hits));
+        }
+        if (mask) return size_t(p - s.data()) + std::countr_zero(mask);
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+    const __m128i quote16 = _mm_set1_epi8('"'), backslash16 = _mm_set1_epi8('\\'), control16 = _mm_set1_epi8(0x1f);
+    for (; end - p >= 16; p += 16) {
+        __m128i  v    = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        uint32_t mask = NON_ASCII ? uint32_t(_mm_movemask_epi8(v)) : 0;
+        if constexpr (ESCAPE) {
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote16), _mm_cmpeq_epi8(v, backslash16)),
+                                        _mm_cmpeq_epi8(_mm_min_epu8(v, control16), v)); // v <= 0x1f
+            mask |= uint32_t(_mm_movemask_epi8(hits));
+        }
+        if (mask) return size_t(p - s.data()) + std::countr_zero(mask);
+    }
+#endif
+    for (; p != end; ++p)
+        if ((ESCAPE && JSON_ESCAPES[uint8_t(*p)]) || (NON_ASCII && uint8_t(*p) >= 0x80)) break;
+    return size_t(p - s.data());
+}
+
+inline size_t findJsonEscape(std::string_view s) {
+    return findSpecialChar<true, false>(s);
+}
+
+//! length of the valid UTF-8 sequence at the start of s, which starts with a non-ASCII byte, or 0 if invalid,
+//! i.e. a bad lead or continuation byte, truncated, overlong, a surrogate or above U+10FFFF.
+inline size_t validUtf8Length(std::string_view s) {
+    uint8_t  c = uint8_t(s[0]);
+    size_t   n = 0;
+    uint32_t cp;
+    if (c >= 0xc2 && c <= 0xdf) n = 2, cp = c & 0x1f;
+    else if (c >= 0xe0 && c <= 0xef) n = 3, cp = c & 0x0f;
+    else if (c >= 0xf0 && c <= 0xf4) n = 4, cp = c & 0x07;
+    else return 0;
+    if (s.size() < n) return 0;
+    for (size_t i = 1; i < n; ++i) {
+        uint8_t b = uint8_t(s[i]);
+        if ((b & 0xc0) != 0x80) return 0;
+        cp = cp << 6 | (b & 0x3f);
+    }
+    if (n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) return 0;
+    if (n == 4 && (cp < 0x10000 || cp > 0x10ffff)) return 0;
+    return n;
+}
+
+//! length of the prefix of s made of whole 16-char blocks of valid UTF-8, which have no char to JSON-escape when ESCAPE
+//! and end on a code point boundary. s starts on a code point boundary. Each block is checked with the lookup tables of
+//! Keiser and Lemire, "Validating UTF-8 in less than one instruction per byte", so it needs SSSE3, else it returns 0.
+template<bool ESCAPE>
+size_t validUtf8Blocks(std::string_view s) {
+    size_t res = 0;
+#if defined(__SSSE3__)
+    // error bits of the lookups of the high and low nibbles of a byte and the high nibble of the next byte.
+    constexpr char TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2, TOO_LARGE = 1 << 3, SURROGATE = 1 << 4,
+                   OVERLONG_2 = 1 << 5, TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6, TWO_CONTS = char(1 << 7);
+    constexpr char CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+    const __m128i byte1High = _mm_setr_epi8(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                                            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, TOO_SHORT | OVERLONG_2, TOO_SHORT,
+                                            TOO_SHORT | OVERLONG_3 | SURROGATE, TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+    const __m128i byte1Low  = _mm_setr_epi8(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+                                            CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+                                            CARRY | TOO_LARGE | TOO_LARGE_1000);
+    const __m128i byte2High = _mm_setr_epi8(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                                            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                                            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                                            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                                            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+    const __m128i nibble = _mm_set1_epi8(0x0f), zero = _mm_setzero_si128();
+    // a lead byte in the last 3, 2 or 1 chars of a block whose sequence continues into the next block.
+    const __m128i incomplete = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xef), char(0xdf), char(0xbf));
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'), control = _mm_set1_epi8(0x1f);
+
+    __m128i prev = zero; // s starts on a boundary, as if after ASCII.
+    for (size_t pos = 0; s.size() - pos >= 16; pos += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + pos));
+        if constexpr (ESCAPE) {
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                        _mm_cmpeq_epi8(_mm_min_epu8(v, control), v)); // v <= 0x1f
+            if (_mm_movemask_epi8(hits)) break;
+        }
+        __m128i prev1 = _mm_alignr_epi8(v, prev, 15), prev2 = _mm_alignr_epi8(v, prev, 14), prev3 = _mm_alignr_epi8(v, prev, 13);
+        __m128i special = _mm_and_si128(_mm_and_si128(_mm_shuffle_epi8(byte1High, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                                                      _mm_shuffle_epi8(byte1Low, _mm_and_si128(prev1, nibble))),
+                                        _mm_shuffle_epi8(byte2High, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+        // the 3rd and 4th bytes of a sequence must be continuations, which the lookups don't check.
+        __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(char(0xe0 - 0x80))),
+                                      _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xf0 - 0x80))));
+        __m128i error  = _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8(char(0x80))), special);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) != 0xffff) break;
+        prev = v;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(v, incomplete), zero)) == 0xffff) res = pos + 16;
+    }
+#endif
+    return res;
+}
+
+//! writes the body of a string, JSON-escaped when escape, and with invalid UTF-8 handled by utf8, in one pass.
+//! Runs of clean chars and valid UTF-8 are written whole, by reference when the sink supports it.
+template<bool ESCAPE, bool CHECK_UTF8, class OSTREAM>
+void writeStringBody(OSTREAM &os, std::string_view s, Utf8Policy utf8) {
+    size_t runStart = 0;
+    for (size_t i = findSpecialChar<ESCAPE, CHECK_UTF8>(s); i < s.size(); i += findSpecialChar<ESCAPE, CHECK_UTF8>(s.substr(i))) {
+        uint8_t c = uint8_t(s[i]);
+        if (c >= 0x80) {
+            if (size_t n = validUtf8Length(s.substr(i))) {
+                i += n; // stays in the run, with the valid blocks after it.
+                i += validUtf8Blocks<ESCAPE>(s.substr(i));
+                continue;
+            }
+        }
+        if (i > runStart) sinkAppendRef(os, s.substr(runStart, i - runStart));
+        if (c >= 0x80) {
+            if (utf8 == Utf8Policy::Replace) {
+                os << std::string_view("\xef\xbf\xbd", 3);
+            } else {
+                char buf[5] = {'\\', '\\', 'x', HEX_PAIRS[c * 2], HEX_PAIRS[c * 2 + 1]};
+                os << (ESCAPE ? std::string_view(buf, 5) : std::string_view(buf + 1, 4));
+            }
+        } else if (char esc = JSON_ESCAPES[c]; esc == 'u') {
+            char buf[6] = {'\\', 'u', '0', '0', HEX_PAIRS[c * 2], HEX_PAIRS[c * 2 + 1]};
+            os << std::string_view(buf, 6);
+        } else {
+            char buf[2] = {'\\', esc};
+            os << std::string_view(buf, 2);
+        }
+        runStart = ++i;
+    }
+    if (s.size() > runStart) sinkAppendRef(os, s.substr(runStart));
+}
+
+template<class OSTREAM>
+void writeStringBody(OSTREAM &os, std::string_view s, bool escape, Utf8Policy utf8) {
+    bool checkUtf8 = utf8 != Utf8Policy::Off;
+    if (escape && checkUtf8) writeStringBody<true, true>(os, s, utf8);
+    else if (escape) writeStringBody<true, false>(os, s, utf8);
+    else if (checkUtf8) writeStringBody<false, true>(os, s, utf8);
+    else sinkAppendRef(os, s);
+}
+
+//! "00000000".."11111111", eight chars per byte.
+inline constexpr std::array<char, 2048> BINARY_OCTETS = [] {
+    std::array<char, 2048> res{};
+    for (size_t i = 0; i < 256; ++i)
+        for (size_t b = 0; b < 8; ++b) res[i * 8 + b] = char('0' + ((i >> (7 - b)) & 1));
+    return res;
+}();
+
+//! chars of u as 0x followed by hex digits without leading zeros.
+inline constexpr uint32_t hexSize(uint64_t u) {
+    return 2 + (u ? (67 - std::countl_zero(u)) / 4 : 1);
+}
+//! writes u as hexSize(u) chars, a byte per lookup. Returns the end.
+inline char *formatHex(char *out, uint64_t u) {
+    char *end = out + hexSize(u), *p = end;
+    std::memcpy(out, "0x", 2);
+    for (; p - out >= 4; u >>= 8) std::memcpy(p -= 2, HEX_PAIRS.data() + (u & 0xff) * 2, 2);
+    if (p - out == 3) p[-1] = HEX_PAIRS[(u & 0xf) * 2 + 1];
+    return end;
+}
+
+//! chars of u as 0b followed by binary digits without leading zeros.
+inline constexpr uint32_t binarySize(uint64_t u) {
+    return 2 + (u ? 64 - std::countl_zero(u) : 1);
+}
+//! writes u as binarySize(u) chars, eight digits per lookup. Returns the end.
+inline char *formatBinary(char *out, uint64_t u) {
+    char *end = out + binarySize(u), *p = end;
+    std::memcpy(out, "0b", 2);
+    for (; p - out >= 10; u >>= 8) std::memcpy(p -= 8, BINARY_OCTETS.data() + (u & 0xff) * 8, 8);
+    size_t rest = size_t(p - out) - 2;
+    std::memcpy(p - rest, BINARY_OCTETS.data() + (u & 0xff) * 8 + 8 - rest, rest);
+    return end;
+}
+
+//! writes the names of the bits set in u joined by '|', e.g. IOC|PostOnly. Bits without a name are appended as hex.
+template<class OSTREAM>
+void writeNamedBits(OSTREAM &os, uint64_t u, std::span<const std::string_view> bitNames) {
+    uint64_t unnamed = 0;
+    bool     first   = true;
+    for (; u; u &= u - 1) {
+        size_t bit = size_t(std::countr_zero(u));
+        if (bit < bitNames.size() && !bitNames[bit].empty()) {
+            if (!first) os << '|';
+            os << bitNames[bit];
+            first = false;
+        } else {
+            unnamed |= uint64_t(1) << bit;
+        }
+    }
+    if (unnamed) {
+        if (!first) os << '|';
+        writeRendered<20>(os, hexSize(unnamed), [&](char *out) { formatHex(out, unnamed); });
+    }
+}
+
+/// How an integer member is printed, selected by FormatStructTrait<T>::IntegerFormat(memberName).
+/// Hex, Binary and NamedBits are strings, quoted by the grammar, of the bits of the value, i.e. two's complement of negatives.
+struct IntFormat {
+    enum Mode : int32_t { Decimal, Hex, Binary, NamedBits };
+
+    Mode                              mode     = Decimal;
+    std::span<const std::string_view> bitNames = {}; // names of bits 0, 1, ... of NamedBits.
+};
+
+//! writes integer val in format.
+template<class OSTREAM, class I>
+void writeInteger(OSTREAM &os, I val, IntFormat const &format, bool quoted) {
+    uint64_t u = uint64_t(std::make_unsigned_t<I>(val));
+    if (format.mode == IntFormat::Decimal) return writeInteger(os, val);
+    if (quoted) os << '\"';
+    if (format.mode == IntFormat::Hex) writeRendered<20>(os, hexSize(u), [&](char *out) { formatHex(out, u); });
+    else if (format.mode == IntFormat::Binary) writeRendered<68>(os, binarySize(u), [&](char *out) { formatBinary(out, u); });
+    else writeNamedBits(os, u, format.bitNames);
+    if (quoted) os << '\"';
+}
+
+//! floatPrecision of shortest representation that round-trips.
+inline constexpr int32_t SHORTEST_FLOAT = -1;
+//! FormatStructTrait<T>::FloatPrecision of a member which uses the floatPrecision of the context.
+inline constexpr int32_t CONTEXT_FLOAT_PRECISION = -2;
+//! max chars of a float. Fixed precision output which doesn't fit falls back to the shortest representation.
+inline constexpr size_t MAX_FLOAT_CHARS = 32;
+
+//! writes val with std::to_chars: the shortest round-trip representation when precision < 0, else fixed with precision digits after the point.
+template<class OSTREAM, class F>
+void writeFloat(OSTREAM &os, F val, int32_t precision) {
+    char                 buf[MAX_FLOAT_CHARS];
+    std::to_chars_result res{buf, std::errc::value_too_large};
+    if (precision >= 0) res = std::to_chars(buf, buf + sizeof(buf), val, std::chars_format::fixed, precision);
+    if (res.ec != std::errc{}) res = std::to_chars(buf, buf + sizeof(buf), val);
+    os << std::string_view(buf, res.ptr - buf);
+}
+
+//! users could list the names of enum values, e.g. 4-byte exchange codes outside the range of magic_enum, instead of magic_enum's.
+//! template<>
+//! struct FormatStructTrait<Venue> {
+//!     static constexpr std::array<std::pair<Venue, std::string_view>, 2> EnumNames() { return {{{Venue::XNAS, "XNAS"}, {Venue::XNYS, "XNYS"}}}; }
+//! };
+template<class E, typename = void>
+constexpr bool HasEnumNames = false;
+
+template<class E>
+constexpr bool HasEnumNames<E, std::void_t<decltype(jz::FormatStructTrait<E>::EnumNames())>> = true;
+
+//! (value, name) of enum E sorted by value, from FormatStructTrait<E>::EnumNames or magic_enum.
+template<class E>
+constexpr auto enumNameEntries() {
+    if constexpr (HasEnumNames<E>) {
+        auto res = jz::FormatStructTrait<E>::EnumNames();
+        for (size_t i = 1; i < res.size(); ++i) // stable insertion sort, constexpr unlike std::stable_sort.
+            for (size_t j = i; j > 0 && res[j].first < res[j - 1].first; --j) std::swap(res[j], res[j - 1]);
+        return res;
+    } else {
+        constexpr auto                                            values = magic_enum::enum_values<E>();
+        std::array<std::pair<E, std::string_view>, values.size()> res{};
+        for (size_t i = 0; i < values.size(); ++i) res[i] = {values[i], magic_enum::enum_name(values[i])};
+        return res; // magic_enum values are sorted and unique.
+    }
+}
+
+/// Quoted names of enum E in one block: direct index by value - MIN for dense values, else binary search of sorted values.
+template<class E, size_t N, size_t CHARS, size_t DENSE_SPAN>
+struct EnumNameTable {
+    using U = std::underlying_type_t<E>;
+
+    std::array<U, N>                 values{};  // sorted.
+    std::array<uint32_t, N + 1>      offsets{}; // quoted name i is chars[offsets[i], offsets[i + 1]).
+    std::array<char, CHARS>          chars{};
+    std::array<uint32_t, DENSE_SPAN> index{}; // 1 + i of value values[0] + k, 0 if no name.
+
+    //! "name" of val, or empty if val has no name.
+    constexpr std::string_view quoted(E val) const {
+        size_t i = 0;
+        if constexpr (DENSE_SPAN > 0) {
+            uint64_t k = uint64_t(U(val)) - uint64_t(values[0]);
+            if (k >= DENSE_SPAN || !index[k]) return {};
+            i = index[k] - 1;
+        } else {
+            auto it = std::lower_bound(values.begin(), values.end(), U(val));
+            if (it == values.end() || *it != U(val)) return {};
+            i = size_t(it - values.begin());
+        }
+        return {chars.data() + offsets[i], offsets[i + 1] - offsets[i]};
+    }
+};
+
+template<class E>
+constexpr auto makeEnumNameTable() {
+    constexpr auto entries = enumNameEntries<E>();
+    constexpr auto sizes   = [&] {
+        std::array<size_t, 3> res{}; // unique values, chars, span.
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (i && entries[i].first == entries[i - 1].first) continue;
+            ++res[0];
+            res[1] += entries[i].second.size() + 2;
+        }
+        if (res[0]) res[2] = size_t(uint64_t(entries.back().first) - uint64_t(entries.front().first)) + 1;
+        return res;
+    }();
+    constexpr size_t denseSpan = sizes[2] <= std::max<size_t>(64, sizes[0] * 4) ? sizes[2] : 0;
+
+    EnumNameTable<E, sizes[0], sizes[1], denseSpan> res{};
+    size_t                                          n = 0, pos = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (i && entries[i].first == entries[i - 1].first) continue; // aliases keep the first name.
+        res.values[n]    = std::underlying_type_t<E>(entries[i].first);
+        res.offsets[n++] = uint32_t(pos);
+        res.chars[pos++] = '"';
+        for (char c : entries[i].second) res.chars[pos++] = c;
+        res.chars[pos++] = '"';
+        if constexpr (denseSpan > 0) res.index[size_t(uint64_t(res.values[n - 1]) - uint64_t(entries.front().first))] = uint32_t(n);
+    }
+    res.offsets[n] = uint32_t(pos);
+    return res;
+}
+//! names of enum E, built once at compile time.
+template<class E>
+inline constexpr auto ENUM_NAMES = makeEnumNameTable<E>();
+
+//! writes the name of val, quoted by one copy. Values without a name are printed as numbers.
+template<class OSTREAM, class E>
+void writeEnum(OSTREAM &os, E val, bool quoted) {
+    std::string_view name = ENUM_NAMES<E>.quoted(val);
+    if (name.empty()) writeInteger(os, std::conditional_t<std::is_signed_v<std::underlying_type_t<E>>, int64_t, uint64_t>(val));
+    else os << (quoted ? name : name.substr(1, name.size() - 2));
+}
+
+/// How system_clock time points are printed.
+enum class TimeFormat : int32_t {
+    Iso8601,    // "2024-05-17T09:30:00.123456789Z" in UTC, with FormatContext::subsecondDigits.
+    EpochNanos, // nanoseconds since the epoch as a number.
+};
+
+template<class T>
+struct IsTimePoint : std::false_type {};
+template<class Duration>
+struct IsTimePoint<std::chrono::time_point<std::chrono::system_clock, Duration>> : std::true_type {};
+template<class T>
+struct IsDuration : std::false_type {};
+template<class Rep, class Period>
+struct IsDuration<std::chrono::duration<Rep, Period>> : std::true_type {};
+
+//! max chars of an ISO-8601 time point, without quotes.
+inline constexpr size_t MAX_ISO_TIME_CHARS = 30;
+
+inline constexpr uint32_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+//! "YYYY-MM-DDT" of the last day printed by this thread, recomputed only when the day changes.
+struct DatePrefixCache {
+    static constexpr size_t SIZE = 11;
+
+    int64_t day = std::numeric_limits<int64_t>::min();
+    char    prefix[SIZE];
+
+    static DatePrefixCache &local() {
+        thread_local DatePrefixCache cache;
+        return cache;
+    }
+    const char *get(int64_t pday) {
+        if (pday != day) {
+            std::chrono::year_month_day ymd{std::chrono::sys_days{std::chrono::days{pday}}};
+            uint32_t                    year = uint32_t(int(ymd.year())); // 1677 to 2262 for nanoseconds.
+            std::memcpy(prefix, DIGIT_PAIRS + year / 100 * 2, 2);
+            std::memcpy(prefix + 2, DIGIT_PAIRS + year % 100 * 2, 2);
+            prefix[4] = '-';
+            std::memcpy(prefix + 5, DIGIT_PAIRS + unsigned(ymd.month()) * 2, 2);
+            prefix[7] = '-';
+            std::memcpy(prefix + 8, DIGIT_PAIRS + unsigned(ymd.day()) * 2, 2);
+            prefix[10] = 'T';
+            day        = pday;
+        }
+        return prefix;
+    }
+};
+
+//! writes ns since the epoch as ISO-8601 UTC with digits (0 to 9) of fractional seconds. Returns the end.
+inline char *formatIsoTime(char *out, int64_t ns, int32_t digits) {
+    constexpr int64_t NS_PER_DAY = 86400 * int64_t(1000000000);
+    int64_t           day        = ns / NS_PER_DAY, nsOfDay = ns % NS_PER_DAY;
+    if (nsOfDay < 0) --day, nsOfDay += NS_PER_DAY;
+    std::memcpy(out, DatePrefixCache::local().get(day), DatePrefixCache::SIZE);
+    out += DatePrefixCache::SIZE;
+
+    uint32_t sec = uint32_t(nsOfDay / 1000000000), frac = uint32_t(nsOfDay % 1000000000);
+    std::memcpy(out, DIGIT_PAIRS + sec / 3600 * 2, 2);
+    out[2] = ':';
+    std::memcpy(out + 3, DIGIT_PAIRS + sec / 60 % 60 * 2, 2);
+    out[5] = ':';
+    std::memcpy(out + 6, DIGIT_PAIRS + sec % 60 * 2, 2);
+    out += 8;
+    if (digits > 0) {
+        digits = std::min(digits, 9);
+        *out   = '.';
+        frac /= POW10[9 - digits];
+        for (char *p = out + digits; p > out; frac /= 10) *p-- = char('0' + frac % 10);
+        out += digits + 1;
+    }
+    *out++ = 'Z';
+    return out;
+}
+
+//! writes a system_clock time point, which is converted to nanoseconds, i.e. years 1677 to 2262.
+template<class OSTREAM, class TimePoint>
+void writeTimePoint(OSTREAM &os, TimePoint const &tp, TimeFormat format, int32_t subsecondDigits, bool quoted) {
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    if (format == TimeFormat::EpochNanos) {
+        writeInteger(os, ns);
+    } else {
+        char  buf[MAX_ISO_TIME_CHARS + 2];
+        char *p = buf;
+        if (quoted) *p++ = '\"';
+        p = formatIsoTime(p, ns, subsecondDigits);
+        if (quoted) *p++ = '\"';
+        os << std::string_view(buf, p - buf);
+    }
+}
+
+//! writes a duration as seconds with subsecondDigits (0 to 9) after the point, truncated, or as nanoseconds for TimeFormat::EpochNanos.
+template<class OSTREAM, class Duration>
+void writeDuration(OSTREAM &os, Duration const &d, TimeFormat format, int32_t subsecondDigits) {
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    if (format == TimeFormat::EpochNanos) {
+        writeInteger(os, ns);
+    } else {
+        subsecondDigits = std::clamp(subsecondDigits, 0, 9);
+        writeScaled(os, ns / int64_t(POW10[9 - subsecondDigits]), uint32_t(subsecondDigits));
+    }
+}
+
+//! value of a member. Getters taking std::pmr::memory_resource * allocate from the sink's resource() if it has one.
+template<class OSTREAM, class MemberT, class T>
+decltype(auto) getMemberValue(OSTREAM &os, MemberT const &memberInfo, T const &obj) {
+    if constexpr (requires { requires MemberT::WITH_RESOURCE; os.resource(); }) return memberInfo.getMember(obj, os.resource());
+    else return memberInfo.getMember(obj);
+}
+//! formats a value returned by a getter, which dies after formatting. Sinks implementing begin/endTransient must copy it.
+template<class OSTREAM, class FormatFunc>
+void sinkTransient(OSTREAM &os, FormatFunc &&formatFunc) {
+    if constexpr (requires {
+                      os.beginTransient();
+                      os.endTransient();
+                  }) {
+        os.beginTransient();
+        formatFunc();
+        os.endTransient();
+    } else {
+        formatFunc();
+    }
+}
+
+/// Compile-time grammar policies for FormatContext<UserContext, GrammarT>. They take no storage in the context,
+/// so delimiters are literals the compiler folds together and quote decisions are constant branches.
+struct JsonSpacedGrammar {
+    static constexpr std::string_view kvBegin = " { ";
+    static constexpr std::string_view kvEnd   = " } ";
+    static constexpr std::string_view kvDelim = " , ";
+    static constexpr std::string_view kvSep   = " : ";
+
+    static constexpr std::string_view vecBegin = " [ ";
+    static constexpr std::string_view vecEnd   = " ] ";
+    static constexpr std::string_view vecDelim = " , ";
+
+    static constexpr bool quotedKey          = true;
+    static constexpr bool quotedVal          = true;
+    static constexpr bool ignoreZeroBitField = true;
+    static constexpr bool escapeStrings      = true;
+};
+struct JsonCompactGrammar {
+    static constexpr std::string_view kvBegin = "{";
+    static constexpr std::string_view kvEnd   = "}";
+    static constexpr std::string_view kvDelim = ",";
+    static constexpr std::string_view kvSep   = ":";
+
+    static constexpr std::string_view vecBegin = "[";
+    static constexpr std::string_view vecEnd   = "]";
+    static constexpr std::string_view vecDelim = ",";
+
+    static constexpr bool quotedKey          = true;
+    static constexpr bool quotedVal          = true;
+    static constexpr bool ignoreZeroBitField = true;
+    static constexpr bool escapeStrings      = true;
+};
+
+struct KeyValueGrammar {
+    static constexpr std::string_view kvBegin = "{";
+    static constexpr std::string_view kvEnd   = "}";
+    static constexpr std::string_view kvDelim = " ";
+    static constexpr std::string_view kvSep   = "=";
+
+    static constexpr std::string_view vecBegin = "[";
+    static constexpr std::string_view vecEnd   = "]";
+    static constexpr std::string_view vecDelim = ",";
+
+    static constexpr bool quotedKey          = false;
+    static constexpr bool quotedVal          = false;
+    static constexpr bool ignoreZeroBitField = true;
+    static constexpr bool escapeStrings      = false;
+};
+
+template<class GrammarT>
+concept StaticGrammar = std::is_pointer_v<decltype(&GrammarT::kvDelim)> && std::is_pointer_v<decltype(&GrammarT::quotedKey)>; // static members
+static_assert(StaticGrammar<JsonCompactGrammar> && !StaticGrammar<FormatterGrammar>);
+
+template<size_t N>
+constexpr std::array<char, N> joinStrings(std::initializer_list<std::string_view> strs) {
+    std::array<char, N> res{};
+    size_t              i = 0;
+    for (auto s : strs)
+        for (char c : s) res[i++] = c;
+    return res;
+}
+
+/// Precomputed key of a struct member. NameT::getName() is constexpr, e.g. MemberInfo, MemberGetter or PfrFieldName.
+template<class NameT>
+struct QuotedName {
+    static constexpr std::string_view    name = NameT::getName();
+    static constexpr std::array<char, name.size() + 2> storage = joinStrings<name.size() + 2>({"\"", name, "\""});
+    static constexpr std::string_view    value{storage.data(), storage.size()};
+};
+
+/// Precomputed `kvDelim "name" kvSep` fragment of a struct member for a static grammar, printed with one write.
+template<class GrammarT, class NameT>
+struct KeyFragment {
+    static constexpr std::string_view key  = GrammarT::quotedKey ? QuotedName<NameT>::value : NameT::getName();
+    static constexpr size_t           SIZE = GrammarT::kvDelim.size() + key.size() + GrammarT::kvSep.size();
+    static constexpr std::array<char, SIZE> storage = joinStrings<SIZE>({GrammarT::kvDelim, key, GrammarT::kvSep});
+
+    static constexpr std::string_view withDelim{storage.data(), SIZE};
+    static constexpr std::string_view withoutDelim = withDelim.substr(GrammarT::kvDelim.size());
+};
+
+/// Name of the I-th field of aggregate T detected by boost::pfr.
+template<class T, size_t I>
+struct PfrFieldName {
+    static constexpr std::string_view getName() { return boost::pfr::names_as_array<T>()[I]; }
+};
+
+/// GrammarT is either the runtime configurable FormatterGrammar or a compile-time policy like JsonCompactGrammar.
+template<class UserContext = int, class GrammarT = FormatterGrammar>
 struct FormatContext {
-    FormatterGrammar grammar;
+    [[no_unique_address]] GrammarT grammar;
     mutable int32_t  flattenMapLevels = 0; // number of first level of map to flatten. WHen a level is flatten, "{k1 : v1, k2: v2}" becomes "v1, v2"
     mutable UserContext userContext;
+    int32_t             floatPrecision  = SHORTEST_FLOAT;      // digits after the point of floats, or SHORTEST_FLOAT.
+    TimeFormat          timeFormat      = TimeFormat::Iso8601; // of std::chrono time points and durations.
+    int32_t             subsecondDigits = 9;                   // 0 to 9 digits of fractional seconds of time points and durations.
+    Utf8Policy          utf8Policy      = Utf8Policy::Off;     // of strings and string keys.
 
     template<class OSTREAM>
     struct ScopedMapPrinter {
@@ -253,10 +1693,10 @@ struct FormatContext {
 
         explicit ScopedMapPrinter(int32_t pcurrLevel, OSTREAM &pos, FormatContext const &pcontext)
             : os(pos), context(pcontext), currLevel(pcurrLevel) {
-            if (!this->context.flattenMapLevels) { os << this->context.grammar.kvBegin; }
+            if (!this->context.flattenMapLevels) { sinkOpenScope(os, this->context.grammar.kvBegin, this->context.grammar.kvEnd); }
         }
         ~ScopedMapPrinter() {
-            if (!context.flattenMapLevels) { os << context.grammar.kvEnd; }
+            if (!context.flattenMapLevels) { sinkCloseScope(os, context.grammar.kvEnd); }
         }
         bool canPrintKey() const { return currLevel >= context.flattenMapLevels; }
     };
@@ -269,10 +1709,33 @@ struct FormatContext {
     template<class OSTREAM, class Key>
     OSTREAM &printKey(OSTREAM &os, const Key &name, int32_t currLevel = 0) const {
         if (currLevel >= flattenMapLevels) {
+            if (grammar.quotedKey) os << '\"';
+            if constexpr (std::is_integral_v<Key>) {
+                writeInteger(os, name);
+            } else if constexpr (std::is_convertible_v<Key const &, std::string_view>) {
+                writeStringBody(os, std::string_view(name), grammar.quotedKey && grammar.escapeStrings, utf8Policy);
+            } else {
+                os << name;
+            }
+            if (grammar.quotedKey) os << '\"';
+            os << grammar.kvSep;
+        }
+        return os;
+    }
+    //! prints delimiter (unless first) and key of a struct member whose name is known at compile time.
+    template<class NameT, class OSTREAM>
+    OSTREAM &printMemberKey(OSTREAM &os, bool first, int32_t currLevel = 0) const {
+        if (currLevel < flattenMapLevels) {
+            if (!first) os << grammar.kvDelim;
+        } else if constexpr (StaticGrammar<GrammarT>) {
+            using Fragment = KeyFragment<GrammarT, NameT>;
+            os << (first ? Fragment::withoutDelim : Fragment::withDelim);
+        } else {
+            if (!first) os << grammar.kvDelim;
             if (grammar.quotedKey) {
-                os << '\"' << name << '\"' << grammar.kvSep;
+                os << QuotedName<NameT>::value << grammar.kvSep;
             } else {
-                os << name << grammar.kvSep;
+                os << NameT::getName() << grammar.kvSep;
             }
         }
         return os;
@@ -280,13 +1743,19 @@ struct FormatContext {
     template<class OSTREAM, class Val>
     OSTREAM &printVal(OSTREAM &os, const Val &val) const {
         if constexpr (std::is_enum_v<Val>) {
-            if (grammar.quotedVal) {
-                os << '\"' << magic_enum::enum_name(val) << '\"';
-            } else {
-                os << magic_enum::enum_name(val);
-            }
-        } else if constexpr (std::is_integral_v<Val> && sizeof(Val) > 1 || std::is_floating_point_v<Val>) { // as int
-            os << val;
+            writeEnum(os, val, grammar.quotedVal);
+        } else if constexpr (std::is_integral_v<Val> && sizeof(Val) > 1) { // as int
+            writeInteger(os, val);
+        } else if constexpr (std::is_floating_point_v<Val>) {
+            writeFloat(os, val, floatPrecision);
+        } else if constexpr (std::is_convertible_v<Val const &, std::string_view>) { // string body
+            if (grammar.quotedVal) os << '\"';
+            writeStringBody(os, std::string_view(val), grammar.quotedVal && grammar.escapeStrings, utf8Policy);
+            if (grammar.quotedVal) os << '\"';
+        } else if constexpr (std::is_same_v<Val, char> || std::is_same_v<Val, signed char> || std::is_same_v<Val, unsigned char>) {
+            if (grammar.quotedVal) os << '\"';
+            writeStringBody(os, std::string_view(reinterpret_cast<const char *>(&val), 1), grammar.quotedVal && grammar.escapeStrings, utf8Policy);
+            if (grammar.quotedVal) os << '\"';
         } else { // as string
             if (grammar.quotedVal) {
                 os << '\"' << val << '\"';
@@ -298,6 +1767,23 @@ struct FormatContext {
     }
 };
 
+/// Statically stored contexts, which are shared by reference across threads and cost nothing to set up.
+/// Their mutable members (flattenMapLevels, userContext) are shared too: a format_struct_impl must not modify them
+/// when handed one of these presets. Copy the preset into your own FormatContext for per-call mutable state.
+template<class UserContext = int, class GrammarT = FormatterGrammar>
+inline const FormatContext<UserContext, GrammarT> defaultFormatContext{};
+
+//! per-call copy of defaultFormatContext, the default context argument of format_struct, StructPrinter and
+//! stringify_struct, so a format_struct_impl may update its mutable members without racing other threads.
+template<class UserContext = int, class GrammarT = FormatterGrammar>
+FormatContext<UserContext, GrammarT> defaultContextCopy() {
+    return defaultFormatContext<UserContext, GrammarT>;
+}
+
+inline const FormatContext<int, JsonSpacedGrammar>  &jsonSpacedContext  = defaultFormatContext<int, JsonSpacedGrammar>;
+inline const FormatContext<int, JsonCompactGrammar> &jsonCompactContext = defaultFormatContext<int, JsonCompactGrammar>;
+inline const FormatContext<int, KeyValueGrammar>    &keyValueContext    = defaultFormatContext<int, KeyValueGrammar>;
+
 //! users could implement this function to format struct.
 //! E.g.
 //! template<>
@@ -319,6 +1805,129 @@ constexpr bool HasGetStructMembersTuple = false;
 template<class T>
 constexpr bool HasGetStructMembersTuple<T, std::void_t<decltype(jz::FormatStructTrait<T>::GetStructMembersTuple())>> = true;
 
+//! users could implement FloatPrecision to set digits after the point of float members, e.g. prices, instead of the context's.
+//! template<>
+//! struct FormatStructTrait<Quote> {
+//!     static constexpr int32_t FloatPrecision(std::string_view memberName) { return memberName == "price" ? 2 : CONTEXT_FLOAT_PRECISION; }
+//! };
+template<class T, typename = void>
+constexpr bool HasFloatPrecision = false;
+
+template<class T>
+constexpr bool HasFloatPrecision<T, std::void_t<decltype(jz::FormatStructTrait<T>::FloatPrecision(std::string_view{}))>> = true;
+
+template<class T, class NameT>
+constexpr int32_t memberFloatPrecision() {
+    if constexpr (HasFloatPrecision<T>) return jz::FormatStructTrait<T>::FloatPrecision(NameT::getName());
+    else return CONTEXT_FLOAT_PRECISION;
+}
+
+//! users could implement DecimalScale to print integer members scaled by 10^scale, e.g. prices in 1/10000, as Decimal<scale>.
+//! template<>
+//! struct FormatStructTrait<PriceLevel> {
+//!     static constexpr uint32_t DecimalScale(std::string_view memberName) { return memberName == "plPrice" ? 4 : 0; }
+//! };
+template<class T, typename = void>
+constexpr bool HasDecimalScale = false;
+
+template<class T>
+constexpr bool HasDecimalScale<T, std::void_t<decltype(jz::FormatStructTrait<T>::DecimalScale(std::string_view{}))>> = true;
+
+//! users could implement IntegerFormat to print integer members, e.g. flag words, as hex, binary or named bits.
+//! template<>
+//! struct FormatStructTrait<OrderMsg> {
+//!     static constexpr std::string_view FLAG_NAMES[] = {"IOC", "PostOnly", "Hidden"};
+//!     static constexpr IntFormat IntegerFormat(std::string_view memberName) {
+//!         if (memberName == "flags") return {IntFormat::NamedBits, FLAG_NAMES};
+//!         return {memberName == "status" ? IntFormat::Hex : IntFormat::Decimal};
+//!     }
+//! };
+template<class T, typename = void>
+constexpr bool HasIntegerFormat = false;
+
+template<class T>
+constexpr bool HasIntegerFormat<T, std::void_t<decltype(jz::FormatStructTrait<T>::IntegerFormat(std::string_view{}))>> = true;
+
+/// Integer member NameT of T printed with FormatStructTrait<T>::IntegerFormat.
+template<class T, class NameT, class I>
+struct FormattedInteger {
+    static constexpr IntFormat FORMAT = jz::FormatStructTrait<T>::IntegerFormat(NameT::getName());
+
+    I value;
+};
+template<class T>
+struct IsFormattedInteger : std::false_type {};
+template<class T, class NameT, class I>
+struct IsFormattedInteger<FormattedInteger<T, NameT, I>> : std::true_type {};
+
+//! type member NameT of T is printed as, i.e. Decimal<scale, V> for a scaled integer, FormattedInteger for hex etc., else V.
+template<class T, class NameT, class V>
+constexpr auto memberPrintType() {
+    if constexpr (std::is_integral_v<V> && !std::is_same_v<V, bool>) {
+        constexpr uint32_t  scale  = [] {
+            if constexpr (HasDecimalScale<T> && sizeof(V) > 1) return jz::FormatStructTrait<T>::DecimalScale(NameT::getName());
+            else return 0u;
+        }();
+        constexpr IntFormat format = [] {
+            if constexpr (HasIntegerFormat<T>) return jz::FormatStructTrait<T>::IntegerFormat(NameT::getName());
+            else return IntFormat{};
+        }();
+        if constexpr (scale > 0) return std::type_identity<Decimal<scale, V>>{};
+        else if constexpr (format.mode != IntFormat::Decimal) return std::type_identity<FormattedInteger<T, NameT, V>>{};
+        else return std::type_identity<V>{};
+    } else {
+        return std::type_identity<V>{};
+    }
+}
+template<class T, class NameT, class V>
+using MemberPrintType = typename decltype(memberPrintType<T, NameT, std::remove_cvref_t<V>>())::type;
+
+//! users could set IS_FLAGS to print an enum holding an OR of its values as their names joined by '|', e.g. "IOC|PostOnly".
+//! Bits above the range of magic_enum, e.g. 0x80 and up by default, are named by EnumNames of the trait,
+//! or by magic_enum in flags mode, i.e. magic_enum::customize::enum_range<E>::is_flags.
+//! template<>
+//! struct FormatStructTrait<OrderFlags> {
+//!     static constexpr bool IS_FLAGS = true;
+//! };
+template<class E, typename = void>
+constexpr bool IsFlagEnum = false;
+
+template<class E>
+constexpr bool IsFlagEnum<E, std::enable_if_t<std::is_enum_v<E> && jz::FormatStructTrait<E>::IS_FLAGS>> = true;
+
+template<class E>
+using FlagBits = std::make_unsigned_t<std::underlying_type_t<E>>;
+
+template<class E>
+constexpr std::array<std::string_view, sizeof(E) * 8> makeFlagNames() {
+    std::array<std::string_view, sizeof(E) * 8> res{};
+    constexpr auto                               entries = enumNameEntries<E>();
+    for (size_t bit = 0; bit < res.size(); ++bit) { // probes every bit, not only the values magic_enum enumerates.
+        E value = E(FlagBits<E>(1) << bit);
+        for (auto const &[entryValue, name] : entries)
+            if (entryValue == value) {
+                res[bit] = name;
+                break;
+            }
+        if (res[bit].empty()) res[bit] = magic_enum::enum_name(value);
+    }
+    return res;
+}
+//! names of the single-bit values of flag enum E indexed by bit position, built once at compile time.
+template<class E>
+inline constexpr std::array<std::string_view, sizeof(E) * 8> FLAG_NAMES = makeFlagNames<E>();
+
+//! writes the names of the bits set in flag enum val, e.g. IOC|PostOnly. Bits without a name are appended as hex.
+//! No bits prints the name of 0, which may be empty.
+template<class OSTREAM, class E>
+void writeFlags(OSTREAM &os, E val, bool quoted) {
+    uint64_t u = uint64_t(FlagBits<E>(val));
+    if (quoted) os << '\"';
+    if (u) writeNamedBits(os, u, FLAG_NAMES<E>);
+    else if (auto name = magic_enum::enum_name(E{}); !name.empty()) os << name;
+    if (quoted) os << '\"';
+}
+
 //! users could implement this function to format struct.
 template<class OSTREAM, class T, class ContextT, typename = void>
 constexpr bool has_format_struct_impl = false;
@@ -357,16 +1966,30 @@ struct DetectObjType {
 
 //! json format aggregate struct, map, vector, etc.
 //! bPrintBraces only controls current level.
-template<class OSTREAM, class T, class UserContext = int>
-OSTREAM &format_struct(OSTREAM &os, T const &obj, FormatContext<UserContext> const &context = FormatContext{}, int32_t currLevel = 0) {
-    if constexpr (has_format_struct_impl<OSTREAM, T, FormatContext<UserContext>>) {
-        return jz::FormatStructTrait<T>::format_struct_impl(os, obj, context, currLevel);
-    } else if constexpr (has_member_format_struct_impl<OSTREAM, T, FormatContext<UserContext>>) {
-        return obj.format_struct_impl(os, context, currLevel);
+template<class OSTREAM, class T, class UserContext = int, class GrammarT = FormatterGrammar>
+OSTREAM &format_struct(OSTREAM &os,
+                       T const &obj,
+                       FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>(),
+                       int32_t currLevel = 0) {
+    // custom formatters may format their locals, which must not outlive the call in the sink.
+    if constexpr (has_format_struct_impl<OSTREAM, T, FormatContext<UserContext, GrammarT>>) {
+        sinkTransient(os, [&] { jz::FormatStructTrait<T>::format_struct_impl(os, obj, context, currLevel); });
+    } else if constexpr (has_member_format_struct_impl<OSTREAM, T, FormatContext<UserContext, GrammarT>>) {
+        sinkTransient(os, [&] { obj.format_struct_impl(os, context, currLevel); });
     } else if constexpr (std::is_same_v<uint8_t, T>) {
         context.printVal(os, uint32_t(obj));
+    } else if constexpr (IsFlagEnum<T>) {
+        writeFlags(os, obj, context.grammar.quotedVal);
     } else if constexpr (std::is_enum_v<T>) {
-        context.printVal(os, magic_enum::enum_name(obj));
+        writeEnum(os, obj, context.grammar.quotedVal);
+    } else if constexpr (IsDecimal<T>::value) {
+        writeScaled(os, obj.value, T::SCALE);
+    } else if constexpr (IsFormattedInteger<T>::value) {
+        writeInteger(os, obj.value, T::FORMAT, context.grammar.quotedVal);
+    } else if constexpr (IsTimePoint<T>::value) {
+        writeTimePoint(os, obj, context.timeFormat, context.subsecondDigits, context.grammar.quotedVal);
+    } else if constexpr (IsDuration<T>::value) {
+        writeDuration(os, obj, context.timeFormat, context.subsecondDigits);
     } else if constexpr (std::is_integral_v<T> || std::is_floating_point_v<T> || IsStr<T>::value) {
         context.printVal(os, obj);
     } else if constexpr (IsVariant<T>::value) {
@@ -385,17 +2008,25 @@ OSTREAM &format_struct(OSTREAM &os, T const &obj, FormatContext<UserContext> con
             }
         }
     } else if constexpr (LikeVec<T>) {
-        os << context.grammar.vecBegin;
+        sinkOpenScope(os, context.grammar.vecBegin, context.grammar.vecEnd);
+        using ElemT = std::remove_cvref_t<decltype(*std::begin(obj))>;
+        if constexpr (BulkInteger<ElemT> && std::contiguous_iterator<decltype(std::begin(obj))> && !requires { os.nextItem(); }) {
+            writeIntegers(os, std::to_address(std::begin(obj)), size_t(std::end(obj) - std::begin(obj)), context.grammar.vecDelim);
+            sinkCloseScope(os, context.grammar.vecEnd);
+            return os;
+        }
         int32_t iFields = 0;
         for (auto &e : obj) {
+            if (!sinkNextItem(os)) break;
             if (iFields++) os << context.grammar.vecDelim;
             format_struct(os, e, context, currLevel + 1);
         }
-        os << context.grammar.vecEnd;
+        sinkCloseScope(os, context.grammar.vecEnd);
     } else if constexpr (LikeMap<T>) {
         auto    scopedMap = context.scopedMap(os, currLevel);
         int32_t iFields   = 0;
         for (auto &[name, value] : obj) {
+            if (!sinkNextItem(os)) break;
             if (iFields++) os << context.grammar.kvDelim;
             context.printKey(os, name, currLevel);
             format_struct(os, value, context, currLevel + 1);
@@ -403,23 +2034,36 @@ OSTREAM &format_struct(OSTREAM &os, T const &obj, FormatContext<UserContext> con
     } else if constexpr (HasGetStructMembersTuple<T>) {
         auto    scopedMap    = context.scopedMap(os, currLevel);
         int32_t iFields      = 0;
-        auto    formatMember = [&](auto &memberInfo) {
+        auto    formatMember = [&]<class MemberT>(MemberT &memberInfo) {
+            if (!sinkNextItem(os)) return;
             if constexpr (memberInfo.IS_BITFIELD) {
+                using PrintT    = MemberPrintType<T, MemberT, typename MemberT::MemberType>;
+                auto printValue = [&](auto v) {
+                    if constexpr (std::is_same_v<PrintT, decltype(v)>) writeInteger(os, v);
+                    else format_struct(os, PrintT{v}, context, currLevel + 1);
+                };
                 if (context.grammar.ignoreZeroBitField) {
                     if (auto v = memberInfo.getMember(obj)) {
-                        if (iFields++) os << context.grammar.kvDelim;
-                        context.printKey(os, memberInfo.getName(), currLevel);
-                        os << v;
+                        context.template printMemberKey<MemberT>(os, iFields++ == 0, currLevel);
+                        printValue(v);
                     }
                 } else {
-                    if (iFields++) os << context.grammar.kvDelim;
-                    context.printKey(os, memberInfo.getName(), currLevel);
-                    os << memberInfo.getMember(obj);
+                    context.template printMemberKey<MemberT>(os, iFields++ == 0, currLevel);
+                    printValue(memberInfo.getMember(obj));
                 }
             } else {
-                if (iFields++) os << context.grammar.kvDelim;
-                context.printKey(os, memberInfo.getName(), currLevel);
-                format_struct(os, memberInfo.getMember(obj), context, currLevel + 1);
+                context.template printMemberKey<MemberT>(os, iFields++ == 0, currLevel);
+                constexpr int32_t precision = memberFloatPrecision<T, MemberT>();
+                using ValueT                = std::remove_cvref_t<decltype(getMemberValue(os, memberInfo, obj))>;
+                if constexpr (precision != CONTEXT_FLOAT_PRECISION && std::is_floating_point_v<ValueT>) {
+                    writeFloat(os, getMemberValue(os, memberInfo, obj), precision);
+                } else if constexpr (!std::is_same_v<MemberPrintType<T, MemberT, ValueT>, ValueT>) {
+                    format_struct(os, MemberPrintType<T, MemberT, ValueT>{getMemberValue(os, memberInfo, obj)}, context, currLevel + 1);
+                } else if constexpr (std::is_reference_v<decltype(getMemberValue(os, memberInfo, obj))>) {
+                    format_struct(os, getMemberValue(os, memberInfo, obj), context, currLevel + 1);
+                } else {
+                    sinkTransient(os, [&] { format_struct(os, getMemberValue(os, memberInfo, obj), context, currLevel + 1); });
+                }
             }
         };
         auto members = jz::FormatStructTrait<T>::GetStructMembersTuple();
@@ -427,25 +2071,30 @@ OSTREAM &format_struct(OSTREAM &os, T const &obj, FormatContext<UserContext> con
         return os;
     } else if constexpr (std::is_class_v<T> && std::is_aggregate_v<T>) {
         auto scopedMap = context.scopedMap(os, currLevel);
-        boost::pfr::for_each_field_with_name(obj, [&, iFields = 0]<class U>(std::string_view name, const U &value) mutable {
-            if (iFields++) os << context.grammar.kvDelim;
-            context.printKey(os, name, currLevel);
+        boost::pfr::for_each_field(obj, [&, iFields = 0](const auto &value, auto index) mutable {
+            using FieldName = PfrFieldName<T, decltype(index)::value>;
+            if (!sinkNextItem(os)) return;
+            context.template printMemberKey<FieldName>(os, iFields++ == 0, currLevel);
 
             if constexpr (HasOverrideMemberAccessors<T>) {
-                constexpr auto overrideMembers = jz::FormatStructTrait<T>::OverrideMemberAccessors();
-                if (std::apply(
-                            [&](auto const &memberGetter) {
-                                if (memberGetter.name.view() == name) {
-                                    format_struct(os, memberGetter.getMember(obj), context, currLevel + 1);
-                                    return true; // found it
-                                }
-                                return false;
-                            },
-                            overrideMembers))
+                constexpr auto   overrideMembers = jz::FormatStructTrait<T>::OverrideMemberAccessors();
+                constexpr size_t iOverride       = findMemberByName(overrideMembers, FieldName::getName());
+                if constexpr (iOverride < std::tuple_size_v<decltype(overrideMembers)>) {
+                    auto &getter = std::get<iOverride>(overrideMembers);
+                    sinkTransient(os, [&] { format_struct(os, getMemberValue(os, getter, obj), context, currLevel + 1); });
                     return;
+                }
             }
 
-            format_struct(os, value, context, currLevel + 1);
+            constexpr int32_t precision = memberFloatPrecision<T, FieldName>();
+            using PrintT                = MemberPrintType<T, FieldName, decltype(value)>;
+            if constexpr (precision != CONTEXT_FLOAT_PRECISION && std::is_floating_point_v<std::remove_cvref_t<decltype(value)>>) {
+                writeFloat(os, value, precision);
+            } else if constexpr (!std::is_same_v<PrintT, std::remove_cvref_t<decltype(value)>>) {
+                format_struct(os, PrintT{value}, context, currLevel + 1);
+            } else {
+                format_struct(os, value, context, currLevel + 1);
+            }
         });
     } else {
         static_assert(sizeof(T) == -1, "unsupported T");
@@ -453,25 +2102,251 @@ OSTREAM &format_struct(OSTREAM &os, T const &obj, FormatContext<UserContext> con
     return os;
 }
 
-template<class T, class UserContext = int>
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
 struct StructPrinter {
-    T const                          &obj;
-    FormatContext<UserContext> const &ctx;
-    int32_t                           currLevel;
-    StructPrinter(T const &pobj, FormatContext<UserContext> const &pcontext = FormatContext{}, int32_t pcurrLevel = 0)
+    T const                                             &obj;
+    std::optional<FormatContext<UserContext, GrammarT>>  ownContext; // the printer's own copy of defaultFormatContext, when none is given.
+    FormatContext<UserContext, GrammarT> const          &ctx;
+    int32_t                                              currLevel;
+    StructPrinter(T const &pobj) : obj(pobj), ownContext(defaultContextCopy<UserContext, GrammarT>()), ctx(*ownContext), currLevel(0) {}
+    StructPrinter(T const &pobj, FormatContext<UserContext, GrammarT> const &pcontext, int32_t pcurrLevel = 0)
         : obj(pobj), ctx(pcontext), currLevel(pcurrLevel) {}
+    StructPrinter(StructPrinter const &other)
+        : obj(other.obj), ownContext(other.ownContext), ctx(ownContext ? *ownContext : other.ctx), currLevel(other.currLevel) {}
 };
 
-template<class T, class UserContext = int>
-std::ostream &operator<<(std::ostream &os, StructPrinter<T, UserContext> const &printer) {
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+std::ostream &operator<<(std::ostream &os, StructPrinter<T, UserContext, GrammarT> const &printer) {
     return format_struct(os, printer.obj, printer.ctx, printer.currLevel);
 }
 
-template<class T, class UserContext = int>
-std::string stringify_struct(T const &obj, FormatContext<UserContext> const &context = FormatContext{}) {
-    std::stringstream ss;
-    format_struct(ss, obj, context);
-    return ss.str();
+struct FormatResult {
+    size_t size      = 0;     // bytes written.
+    bool   truncated = false; // output didn't fit and open braces and brackets were closed early.
+};
+
+//! format into caller-provided storage, e.g. a stack array, without allocation. The output is not null-terminated.
+//! When it fits, the output is the same as stringify_struct.
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+FormatResult format_struct_into(char *buf,
+                                size_t cap,
+                                T const &obj,
+                                FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    FixedBufferSink sink(buf, cap);
+    format_struct(sink, obj, context);
+    return {sink.size(), sink.truncated()};
 }
 
-} // namespace jz
\ No newline at end of file
+//! format through output iterator. Returns the iterator past the last written char.
+template<class OutputIt, class T, class UserContext = int, class GrammarT = FormatterGrammar>
+OutputIt format_struct_to(OutputIt out,
+                          T const &obj,
+                          FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>(),
+                          int32_t currLevel = 0) {
+    OutputIteratorSink<OutputIt> sink(std::move(out));
+    format_struct(sink, obj, context, currLevel);
+    return std::move(sink.out);
+}
+
+template<class MemberT, class GrammarT>
+constexpr size_t memberSizeBound();
+template<class T, size_t I, class GrammarT>
+constexpr size_t pfrFieldSizeBound();
+
+//! sum or max of size bounds, or 0 if any is unbounded.
+constexpr size_t sumSizeBounds(std::initializer_list<size_t> bounds, bool max = false) {
+    size_t res = 0;
+    for (size_t b : bounds) {
+        if (!b) return 0;
+        res = max ? std::max(res, b) : res + b;
+    }
+    return res;
+}
+
+//! upper bound of the formatted size of a fixed-shape T, i.e. numbers, enums, std::array, variant and structs of them,
+//! for a static grammar. It's 0 if T isn't fixed-shape, e.g. has strings, containers, pointers or custom format_struct_impl.
+//! E.g. FormattedString<formatted_size_bound<PriceLevel, JsonCompactGrammar>()> never spills.
+template<class T, StaticGrammar GrammarT = JsonSpacedGrammar>
+constexpr size_t formatted_size_bound() {
+    using ContextT          = FormatContext<int, GrammarT>;
+    constexpr size_t quotes = GrammarT::quotedVal ? 2 : 0;
+    if constexpr (has_format_struct_impl<CountingSink, T, ContextT> || has_member_format_struct_impl<CountingSink, T, ContextT>) {
+        return 0;
+    } else if constexpr (std::is_same_v<uint8_t, T>) {
+        return 3;
+    } else if constexpr (IsFlagEnum<T>) {
+        size_t n = 2 + sizeof(T) * 2; // unnamed bits as hex.
+        for (auto name : makeFlagNames<T>()) n += name.size() + !name.empty();
+        return std::max(n, magic_enum::enum_name(T{}).size()) + quotes;
+    } else if constexpr (std::is_enum_v<T>) {
+        size_t n = std::numeric_limits<std::underlying_type_t<T>>::digits10 + 2; // numbers of values without a name.
+        for (auto [value, name] : enumNameEntries<T>()) n = std::max(n, name.size() + quotes);
+        return n;
+    } else if constexpr (std::is_integral_v<T> && sizeof(T) > 1) {
+        return std::numeric_limits<T>::digits10 + 1 + std::is_signed_v<T>;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        return MAX_FLOAT_CHARS;
+    } else if constexpr (IsDecimal<T>::value) {
+        using Rep = typename T::Rep;
+        return std::max<size_t>(std::numeric_limits<Rep>::digits10 + 1, T::SCALE + 1) + (T::SCALE > 0) + std::is_signed_v<Rep>;
+    } else if constexpr (IsFormattedInteger<T>::value) {
+        constexpr IntFormat format = T::FORMAT;
+        if constexpr (format.mode == IntFormat::Hex) return 2 + sizeof(T::value) * 2 + quotes;
+        else if constexpr (format.mode == IntFormat::Binary) return 2 + sizeof(T::value) * 8 + quotes;
+        size_t n = 2 + sizeof(T::value) * 2 + quotes; // unnamed bits as hex.
+        for (auto name : format.bitNames) n += name.size() + 1;
+        return n;
+    } else if constexpr (IsTimePoint<T>::value) {
+        return MAX_ISO_TIME_CHARS + quotes;
+    } else if constexpr (IsDuration<T>::value) {
+        return MAX_INTEGER_CHARS + 1; // nanoseconds, or seconds with the point.
+    } else if constexpr (std::is_integral_v<T>) { // bool, char as quoted char
+        return (GrammarT::quotedVal && GrammarT::escapeStrings ? 6 : 1) + quotes; // \u00XX
+    } else if constexpr (IsVariant<T>::value) {
+        return []<class... Alts>(std::variant<Alts...> *) {
+            return sumSizeBounds({formatted_size_bound<Alts, GrammarT>()...}, true);
+        }((T *)nullptr);
+    } else if constexpr (LikeVec<T> && !IsStr<T>::value && (std::is_bounded_array_v<T> || requires { std::tuple_size<T>::value; })) {
+        constexpr size_t n    = std::is_bounded_array_v<T> ? std::extent_v<T> : std::tuple_size<T>::value;
+        constexpr size_t elem = formatted_size_bound<std::remove_cvref_t<decltype(std::declval<T const &>()[0])>, GrammarT>();
+        if (!elem) return 0;
+        return GrammarT::vecBegin.size() + GrammarT::vecEnd.size() + n * elem + (n ? (n - 1) * GrammarT::vecDelim.size() : 0);
+    } else if constexpr (HasGetStructMembersTuple<T>) {
+        constexpr auto members = FormatStructTrait<T>::GetStructMembersTuple();
+        return std::apply(
+                []<class... MemberT>(MemberT const &...) -> size_t {
+                    size_t fields = sumSizeBounds({memberSizeBound<MemberT, GrammarT>()...});
+                    return fields ? GrammarT::kvBegin.size() + GrammarT::kvEnd.size() + fields - GrammarT::kvDelim.size() : 0;
+                },
+                members);
+    } else if constexpr (std::is_class_v<T> && std::is_aggregate_v<T> && !IsLikePointer<T> && !LikeVec<T> && !LikeMap<T> && !IsStr<T>::value) {
+        return []<size_t... I>(std::index_sequence<I...>) -> size_t {
+            size_t fields = sumSizeBounds({pfrFieldSizeBound<T, I, GrammarT>()...});
+            return fields ? GrammarT::kvBegin.size() + GrammarT::kvEnd.size() + fields - GrammarT::kvDelim.size() : 0;
+        }(std::make_index_sequence<boost::pfr::tuple_size_v<T>>{});
+    } else {
+        return 0;
+    }
+}
+//! bound of a member with its key and delimiter.
+template<class MemberT, class GrammarT>
+constexpr size_t memberSizeBound() {
+    using ValueType = std::remove_cvref_t<typename MemberT::MemberType>;
+    size_t value    = 0;
+    using PrintT    = MemberPrintType<typename MemberT::ClassType, MemberT, ValueType>;
+    if constexpr (MemberT::IS_BITFIELD && std::is_same_v<PrintT, ValueType>) value = std::numeric_limits<ValueType>::digits10 + 2; // number.
+    else value = formatted_size_bound<PrintT, GrammarT>();
+    return value ? KeyFragment<GrammarT, MemberT>::withDelim.size() + value : 0;
+}
+template<class T, size_t I, class GrammarT>
+constexpr size_t pfrFieldSizeBound() {
+    using FieldName = PfrFieldName<T, I>;
+    if constexpr (HasOverrideMemberAccessors<T>) {
+        constexpr auto   overrideMembers = FormatStructTrait<T>::OverrideMemberAccessors();
+        constexpr size_t iOverride       = findMemberByName(overrideMembers, FieldName::getName());
+        if constexpr (iOverride < std::tuple_size_v<decltype(overrideMembers)>) {
+            using Getter = std::remove_cvref_t<decltype(std::get<iOverride>(overrideMembers))>;
+            size_t value = formatted_size_bound<std::remove_cvref_t<typename Getter::MemberType>, GrammarT>();
+            return value ? KeyFragment<GrammarT, FieldName>::withDelim.size() + value : 0;
+        }
+    }
+    size_t value = formatted_size_bound<MemberPrintType<T, FieldName, boost::pfr::tuple_element_t<I, T>>, GrammarT>();
+    return value ? KeyFragment<GrammarT, FieldName>::withDelim.size() + value : 0;
+}
+
+//! number of bytes format_struct writes for obj.
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+size_t formatted_size(T const &obj, FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    CountingSink sink;
+    format_struct(sink, obj, context);
+    return sink.count;
+}
+
+//! appends formatted obj to out, e.g. std::string or std::vector<char>, growing it in place.
+template<class StringT, class T, class UserContext = int, class GrammarT = FormatterGrammar>
+    requires std::is_same_v<typename StringT::value_type, char> && requires(StringT &out) { out.resize(out.capacity()); }
+StringT &format_struct_append(StringT &out,
+                              T const &obj,
+                              FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    BasicFormatBuffer<StringT> buf(std::move(out));
+    try {
+        format_struct(buf, obj, context);
+    } catch (...) {
+        out = std::move(buf).str();
+        throw;
+    }
+    out = std::move(buf).str();
+    return out;
+}
+
+//! format into a buffer taken from the thread-local StringPool, which the returned handle gives back on destruction.
+//! Repeated calls reach steady state without malloc/free.
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+PooledString stringify_struct_pooled(T const &obj,
+                                     FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    FormatBuffer buf(StringPool::acquire());
+    format_struct(buf, obj, context);
+    return PooledString(std::move(buf).str());
+}
+
+//! format into a FormattedString with N bytes of inline storage, e.g. stringify_struct<256>(obj).
+template<size_t N, class T, class UserContext = int, class GrammarT = FormatterGrammar>
+FormattedString<N> stringify_struct(T const &obj,
+                                    FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    FormattedString<N> res;
+    format_struct(res, obj, context);
+    return res;
+}
+
+//! format into buf and move its content out.
+template<class StringT, class T, class UserContext = int, class GrammarT = FormatterGrammar>
+StringT stringify_struct(BasicFormatBuffer<StringT> &&buf,
+                         T const &obj,
+                         FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    format_struct(buf, obj, context);
+    return std::move(buf).str();
+}
+
+//! format into a std::pmr::string allocated from resource, e.g. a std::pmr::monotonic_buffer_resource.
+//! Getters taking std::pmr::memory_resource * allocate their results from resource too.
+//! The output is reserved once after a counting pass, whose getter results come from the default resource.
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+std::pmr::string stringify_struct(T const &obj,
+                                  std::pmr::memory_resource *resource,
+                                  FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    CountingSink counter; // not charging resource for results thrown away.
+    format_struct(counter, obj, context);
+
+    BasicFormatBuffer<std::pmr::string> buf{std::pmr::string(resource)};
+    buf.reserve(counter.count);
+    return stringify_struct(std::move(buf), obj, context);
+}
+
+//! format in one pass, reserving formatted_size_bound when T is fixed-shape and the grammar static.
+//! To reserve the exact size, which runs getters and format_struct_impl twice, pass a FormatBuffer reserved with formatted_size.
+template<class T, class UserContext = int, class GrammarT = FormatterGrammar>
+std::string stringify_struct(T const &obj, FormatContext<UserContext, GrammarT> const &context = defaultContextCopy<UserContext, GrammarT>()) {
+    FormatBuffer buf;
+    if constexpr (StaticGrammar<GrammarT>) {
+        if constexpr (constexpr size_t bound = formatted_size_bound<T, GrammarT>()) buf.reserve(bound);
+    }
+    return stringify_struct(std::move(buf), obj, context);
+}
+
+} // namespace jz
+
+#ifdef __cpp_lib_format
+/// std::format("{}", jz::StructPrinter{obj}) writes straight into the format output iterator.
+template<class T, class UserContext, class GrammarT>
+struct std::formatter<jz::StructPrinter<T, UserContext, GrammarT>, char> {
+    constexpr auto parse(std::format_parse_context &ctx) {
+        auto it = ctx.begin();
+        if (it != ctx.end() && *it != '}') throw std::format_error("jz::StructPrinter doesn't take format spec");
+        return it;
+    }
+    template<class FormatContextT>
+    auto format(jz::StructPrinter<T, UserContext, GrammarT> const &printer, FormatContextT &ctx) const {
+        return jz::format_struct_to(ctx.out(), printer.obj, printer.ctx, printer.currLevel);
+    }
+};
+#endif
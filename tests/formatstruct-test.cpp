@@ -1,5 +1,7 @@
 #include "UnitTest.h"
 #include <formatstruct.h>
+#include <random>
+#include <span>
 
 
 enum class Color
@@ -100,3 +102,1061 @@ TEST_CASE( "formatstruct - bitfield, pointer" )
     res = R"( { "id" : "id1" , "name" : "John" , "account" :  { "hasAccount" : 1 , "flags" : 3 , "amount" : 100 }  , "friends" :  [  { "id" : "id2" , "name" : "Bob" , "account" :  { "amount" : 0 }  , "friends" :  [  ]  }  ,  { "id" : "id3" , "name" : "Alice" , "account" :  { "hasAccount" : 1 , "flags" : 1 , "amount" : 300 }  , "friends" :  [  ]  }  ]  } )";
     CHECK_EQ( res, jz::stringify_struct( a ) );
 }
+
+//==================================================================================
+//    Test FormatBuffer
+//==================================================================================
+
+struct Quote
+{
+    double                   price;
+    float                    qty;
+    int8_t                   tag;
+    uint8_t                  level;
+    std::vector<long long>   sizes;
+    std::optional<long>      parent;
+};
+
+TEST_CASE( "formatstruct - FormatBuffer" )
+{
+    Quote q{ .price = 101.25, .qty = 3.5f, .tag = 'x', .level = 7, .sizes = { -1, 0, 1234567890123LL }, .parent = {} };
+    std::stringstream ss;
+    jz::format_struct( ss, q );
+    CHECK_EQ( jz::stringify_struct( q ), ss.str() );
+
+    jz::FormatBuffer buf;
+    for ( int i = 0; i < 100; ++i )
+        jz::format_struct( buf, q );
+    CHECK_EQ( buf.size(), ss.str().size() * 100 );
+    CHECK_EQ( buf.view().substr( 0, ss.str().size() ), ss.str() );
+
+    std::string res = std::move( buf ).str();
+    CHECK_EQ( res.size(), ss.str().size() * 100 );
+    CHECK_EQ( buf.size(), 0 );
+}
+
+TEST_CASE( "formatstruct - format_struct_to" )
+{
+    Account     account{ .hasAccount = 1, .flags = 3, .amount = 100 };
+    std::string expected = jz::stringify_struct( account );
+
+    std::string res;
+    jz::format_struct_to( std::back_inserter( res ), account );
+    CHECK_EQ( res, expected );
+
+    char  buf[128];
+    char *end = jz::format_struct_to( buf, account );
+    CHECK_EQ( std::string_view( buf, end - buf ), expected );
+
+#ifdef __cpp_lib_format
+    CHECK_EQ( std::format( "{}", jz::StructPrinter{ account } ), expected );
+#endif
+}
+
+TEST_CASE( "formatstruct - format_struct_into" )
+{
+    Account account{ .hasAccount = 1, .flags = 3, .amount = 100 };
+    char    buf[512];
+    auto    res = jz::format_struct_into( buf, sizeof( buf ), account );
+    CHECK_FALSE( res.truncated );
+    CHECK_EQ( std::string_view( buf, res.size ), jz::stringify_struct( account ) );
+
+    res = jz::format_struct_into( buf, 40, account );
+    CHECK( res.truncated );
+    CHECK_EQ( std::string_view( buf, res.size ), R"( { "hasAccount" : 1 , "flags" : 3 } )" );
+
+    auto a = std::make_unique<User>( 1, "John", Account{ .hasAccount = 1, .flags = 3, .amount = 100 } );
+    a->friends.push_back( std::make_unique<User>( 2, "Bob" ) );
+    a->friends.push_back( std::make_unique<User>( 3, "Alice", Account{ .hasAccount = 1, .flags = 1, .amount = 300 } ) );
+    std::string full = jz::stringify_struct( a );
+    for ( size_t cap = 0; cap <= full.size(); ++cap )
+    {
+        res = jz::format_struct_into( buf, cap, a );
+        std::string_view out( buf, res.size );
+        CHECK_LE( res.size, cap );
+        CHECK_EQ( res.truncated, cap < full.size() );
+        CHECK_EQ( std::count( out.begin(), out.end(), '{' ), std::count( out.begin(), out.end(), '}' ) );
+        CHECK_EQ( std::count( out.begin(), out.end(), '[' ), std::count( out.begin(), out.end(), ']' ) );
+    }
+    CHECK_EQ( std::string_view( buf, res.size ), full );
+}
+
+TEST_CASE( "formatstruct - formatted_size" )
+{
+    Quote q{ .price = -0.001, .qty = 1e20f, .tag = 'x', .level = 255, .sizes = { INT64_MIN, INT64_MAX, -9, 10, 0 }, .parent = -100 };
+    CHECK_EQ( jz::formatted_size( q ), jz::stringify_struct( q ).size() );
+
+    auto a = std::make_unique<User>( 1, "John", Account{ .hasAccount = 1, .flags = 3, .amount = 100 } );
+    for ( int i = 0; i < 10; ++i )
+        a->friends.push_back( std::make_unique<User>( i * 1000, "Bob", Account{ .hasAccount = 0, .flags = 2, .amount = 300 } ) );
+    CHECK_EQ( jz::formatted_size( a ), jz::stringify_struct( a ).size() );
+}
+
+TEST_CASE( "formatstruct - grammar policy" )
+{
+    A a = { .id = 1, .name = "John", .color = Color::Pink, .nested = Nested{ .ids = { 2, 3, 4 }, .amap = { { "A", 10 }, { "B", 20 } } } };
+
+    jz::FormatContext<int, jz::JsonCompactGrammar> compact;
+    static_assert( sizeof( compact ) == sizeof( jz::FormatContext<int, std::monostate> ) ); // grammar takes no space
+    CHECK_EQ( jz::stringify_struct( a, compact ), R"({"id":1,"name":"John","color":"Pink","nested":{"ids":[2,3,4],"amap":{"A":10,"B":20}}})" );
+
+    jz::FormatContext<int, jz::JsonSpacedGrammar> spaced;
+    CHECK_EQ( jz::stringify_struct( a, spaced ), jz::stringify_struct( a ) );
+
+    std::stringstream ss;
+    ss << jz::StructPrinter{ a, compact };
+    CHECK_EQ( ss.str(), jz::stringify_struct( a, compact ) );
+}
+
+struct Order
+{
+    int         id;
+    double      price;
+    std::string side;
+};
+
+namespace jz
+{
+template<>
+struct FormatStructTrait<Order>
+{
+    static constexpr auto OverrideMemberAccessors()
+    {
+        return jz::make_struct_members<
+                MEMBER_ACCESSOR( Order, "side", []( Order const &obj ) { return std::string( obj.side == "B" ? "Buy" : "Sell" ); } ),
+                MEMBER_ACCESSOR( Order, "id", []( Order const &obj ) { return obj.id * 10; } )>();
+    }
+};
+} // namespace jz
+
+TEST_CASE( "formatstruct - key fragments" )
+{
+    using AmountInfo = jz::MemberInfoCreator<&Account::amount>::type;
+    static_assert( jz::KeyFragment<jz::JsonCompactGrammar, AmountInfo>::withDelim == R"(,"amount":)" );
+    static_assert( jz::KeyFragment<jz::JsonCompactGrammar, AmountInfo>::withoutDelim == R"("amount":)" );
+    static_assert( jz::KeyFragment<jz::JsonSpacedGrammar, jz::PfrFieldName<Order, 1>>::withDelim == R"( , "price" : )" );
+    static_assert( jz::QuotedName<AmountInfo>::value == R"("amount")" );
+
+    Order order{ .id = 7, .price = 1.5, .side = "B" };
+    CHECK_EQ( jz::stringify_struct( order ), R"( { "id" : 70 , "price" : 1.5 , "side" : "Buy" } )" );
+    CHECK_EQ( jz::stringify_struct( order, jz::FormatContext<int, jz::JsonCompactGrammar>{} ), R"({"id":70,"price":1.5,"side":"Buy"})" );
+
+    jz::FormatContext<> unquoted;
+    unquoted.grammar.quotedKey = false;
+    CHECK_EQ( jz::stringify_struct( order, unquoted ), R"( { id : 70 , price : 1.5 , side : "Buy" } )" );
+}
+
+struct NoDefaultUserContext
+{
+    explicit NoDefaultUserContext( int ) {}
+};
+
+TEST_CASE( "formatstruct - preset contexts" )
+{
+    Order order{ .id = 7, .price = 1.5, .side = "S" };
+    CHECK_EQ( jz::stringify_struct( order, jz::jsonSpacedContext ), jz::stringify_struct( order ) );
+    CHECK_EQ( jz::stringify_struct( order, jz::jsonCompactContext ), R"({"id":70,"price":1.5,"side":"Sell"})" );
+    CHECK_EQ( jz::stringify_struct( order, jz::keyValueContext ), R"({id=70 price=1.5 side=Sell})" );
+
+    jz::StructPrinter printer{ order };
+    CHECK_EQ( &printer.ctx, &*printer.ownContext );
+    jz::StructPrinter copy = printer;
+    CHECK_EQ( &copy.ctx, &*copy.ownContext );
+    jz::StructPrinter compact( order, jz::jsonCompactContext );
+    CHECK_EQ( &compact.ctx, &jz::jsonCompactContext );
+    CHECK_FALSE( compact.ownContext );
+
+    jz::FormatContext<NoDefaultUserContext> noDefault{ .grammar = {}, .userContext = NoDefaultUserContext( 1 ) };
+    std::ostringstream                      ss;
+    ss << jz::StructPrinter<Order, NoDefaultUserContext>( order, noDefault );
+    CHECK_EQ( ss.str(), jz::stringify_struct( order ) );
+
+    jz::FormatContext<> custom{ .grammar = { .kvDelim = "; ", .kvSep = ": " }, .userContext = 0 };
+    CHECK_EQ( jz::stringify_struct( order, custom ), R"( { "id": 70; "price": 1.5; "side": "Sell" } )" );
+}
+
+struct Counted
+{
+    int v;
+
+    template<class OSTREAM, class ContextT>
+    OSTREAM &format_struct_impl( OSTREAM &os, ContextT const &context, int32_t ) const
+    {
+        return os << v + context.userContext++;
+    }
+};
+
+TEST_CASE( "formatstruct - default context userContext is per call" )
+{
+    std::vector<Counted> items( 3, Counted{ 10 } );
+    CHECK_EQ( jz::stringify_struct( items ), jz::stringify_struct( items ) );
+    CHECK_EQ( jz::defaultFormatContext<>.userContext, 0 );
+
+    jz::FormatContext<> own{};
+    jz::stringify_struct( items, own );
+    CHECK_EQ( own.userContext, 3 );
+}
+
+#ifdef JZ_HAS_POSIX_SINKS
+struct Message
+{
+    int                      seq;
+    std::string              body;
+    std::vector<std::string> parts;
+};
+
+namespace jz
+{
+template<>
+struct FormatStructTrait<Message>
+{
+    static constexpr auto OverrideMemberAccessors()
+    {
+        return jz::make_struct_members<MEMBER_ACCESSOR( Message, "seq", []( Message const &obj ) { return std::string( 100, 'a' + obj.seq ); } )>();
+    }
+};
+} // namespace jz
+
+struct Banner
+{
+    int width;
+
+    template<class OSTREAM, class ContextT>
+    OSTREAM &format_struct_impl( OSTREAM &os, ContextT const &ctx, int32_t lvl ) const
+    {
+        std::string line( width, '=' );
+        return jz::format_struct( os, line, ctx, lvl );
+    }
+};
+
+static std::string readFile( std::FILE *f )
+{
+    std::string res( std::ftell( f ), '\0' );
+    std::rewind( f );
+    res.resize( std::fread( res.data(), 1, res.size(), f ) );
+    return res;
+}
+
+TEST_CASE( "formatstruct - IovecSink" )
+{
+    Message msg{ .seq = 1, .body = std::string( 1000, 'x' ), .parts = { "short", std::string( 200, 'y' ), std::string( 20000, 'z' ) } };
+    std::string expected;
+    for ( int i = 0; i < 50; ++i )
+        expected += jz::stringify_struct( msg );
+
+    std::FILE *f = std::tmpfile();
+    {
+        jz::IovecSink sink( fileno( f ), 256 );
+        for ( int i = 0; i < 50; ++i )
+            jz::format_struct( sink, msg );
+        CHECK( sink.flush() );
+    }
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( readFile( f ), expected );
+    std::fclose( f );
+
+    std::vector<Banner> banners( 3, Banner{ 100 } );
+    f = std::tmpfile();
+    {
+        jz::IovecSink sink( fileno( f ) );
+        jz::format_struct( sink, banners );
+        CHECK( sink.flush() );
+    }
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( readFile( f ), jz::stringify_struct( banners ) );
+    std::fclose( f );
+}
+
+TEST_CASE( "formatstruct - IovecSink over 256 iovecs" )
+{
+    std::vector<std::string> parts;
+    for ( int i = 0; i < 600; ++i )
+        parts.push_back( i % 2 ? std::string( 64, char( 'a' + i % 26 ) ) : std::to_string( i ) );
+
+    std::FILE *f = std::tmpfile();
+    {
+        jz::IovecSink sink( fileno( f ) );
+        jz::format_struct( sink, parts );
+        CHECK( sink.flush() );
+    }
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( readFile( f ), jz::stringify_struct( parts ) );
+    std::fclose( f );
+}
+
+TEST_CASE( "formatstruct - FdSink" )
+{
+    Message     msg{ .seq = 2, .body = "body", .parts = { "a", std::string( 300, 'y' ) } };
+    std::string one = jz::stringify_struct( msg );
+
+    std::FILE *f = std::tmpfile();
+    jz::FdSink sink( fileno( f ), 128, 3 );
+    for ( int i = 0; i < 1000; ++i )
+        jz::format_struct( sink, msg );
+    CHECK( sink.flush() );
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( size_t( std::ftell( f ) ), one.size() * 1000 );
+
+    jz::format_struct( sink, msg );
+    CHECK( sink.close() );
+    std::fseek( f, 0, SEEK_END );
+    std::string all = readFile( f );
+    CHECK_EQ( all.size(), one.size() * 1001 );
+    CHECK_EQ( all.substr( one.size() * 1000 ), one );
+
+    for ( int i = 0; i < 10; ++i ) // dropped after close, without waiting for the stopped writer.
+        jz::format_struct( sink, msg );
+    CHECK( sink.flush() );
+    CHECK_EQ( sink.error(), 0 );
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( readFile( f ).size(), one.size() * 1001 );
+    std::fclose( f );
+
+    f = std::tmpfile();
+    {
+        jz::FdSink tiny( fileno( f ), 0 ); // buffer size is clamped to 1.
+        jz::format_struct( tiny, msg );
+        CHECK( tiny.close() );
+    }
+    std::fseek( f, 0, SEEK_END );
+    CHECK_EQ( readFile( f ), one );
+    std::fclose( f );
+}
+
+TEST_CASE( "formatstruct - MmapSink" )
+{
+    Message     msg{ .seq = 3, .body = "body", .parts = { "a", std::string( 300, 'y' ) } };
+    std::string one = jz::stringify_struct( msg );
+
+    char path[] = "/tmp/formatstruct-test-XXXXXX";
+    ::close( ::mkstemp( path ) );
+    {
+        jz::MmapSink sink( path, 1 ); // window is rounded up to a page.
+        CHECK_EQ( sink.size(), 0 );
+        for ( int i = 0; i < 100; ++i )
+            jz::format_struct( sink, msg );
+        CHECK_EQ( sink.size(), one.size() * 100 );
+        CHECK( sink.close() );
+        for ( int i = 0; i < 10; ++i )
+            jz::format_struct( sink, msg );
+        CHECK_EQ( sink.size(), one.size() * 100 );
+        CHECK( sink.close() );
+    }
+    std::FILE *f = std::fopen( path, "rb" );
+    std::fseek( f, 0, SEEK_END );
+    std::string all = readFile( f );
+    std::fclose( f );
+    ::unlink( path );
+    CHECK_EQ( all.size(), one.size() * 100 );
+    CHECK_EQ( all.substr( one.size() * 99 ), one );
+}
+#endif
+
+struct Tick
+{
+    static inline int formatted = 0;
+
+    int v;
+
+    template<class OSTREAM, class ContextT>
+    OSTREAM &format_struct_impl( OSTREAM &os, ContextT const &, int32_t ) const
+    {
+        ++formatted;
+        return os << v;
+    }
+};
+
+TEST_CASE( "formatstruct - ChunkedSink" )
+{
+    std::vector<Tick> ticks( 1000, Tick{ 12345 } );
+    std::string       expected = jz::stringify_struct( ticks );
+
+    std::vector<std::string> chunks;
+    jz::ChunkedSink          sink( 64, [&]( std::string_view chunk ) {
+        chunks.emplace_back( chunk );
+        return true;
+    } );
+    jz::format_struct( sink, ticks );
+    CHECK( sink.flush() );
+    CHECK_EQ( chunks.size(), ( expected.size() + 63 ) / 64 );
+    CHECK_EQ( std::accumulate( chunks.begin(), chunks.end(), std::string() ), expected );
+
+    Tick::formatted = 0;
+    chunks.clear();
+    jz::ChunkedSink stopping( 64, [&]( std::string_view chunk ) {
+        chunks.emplace_back( chunk );
+        return chunks.size() < 2;
+    } );
+    jz::format_struct( stopping, ticks );
+    CHECK( stopping.stopped() );
+    CHECK_FALSE( stopping.flush() );
+    CHECK_EQ( chunks.size(), 2 );
+    CHECK_EQ( chunks[0] + chunks[1], expected.substr( 0, 128 ) );
+    CHECK_LT( Tick::formatted, 20 );
+}
+
+TEST_CASE( "formatstruct - format_struct_append" )
+{
+    Account     account{ .hasAccount = 1, .flags = 3, .amount = 100 };
+    std::string json = jz::stringify_struct( account );
+
+    std::string line = "12:00:00 tid=1";
+    line.reserve( 1024 );
+    const char *data = line.data();
+    jz::format_struct_append( line, account );
+    jz::format_struct_append( line, account, jz::jsonCompactContext );
+    CHECK_EQ( line, "12:00:00 tid=1" + json + R"({"hasAccount":1,"flags":3,"amount":100})" );
+    CHECK_EQ( line.data(), data );
+
+    std::vector<char> vec = { '>' };
+    jz::format_struct_append( vec, account );
+    CHECK_EQ( std::string_view( vec.data(), vec.size() ), ">" + json );
+}
+
+struct Session
+{
+    int         id;
+    std::string user;
+};
+
+namespace jz
+{
+template<>
+struct FormatStructTrait<Session>
+{
+    static constexpr auto OverrideMemberAccessors()
+    {
+        return jz::make_struct_members<MEMBER_ACCESSOR( Session, "user", []( Session const &obj, std::pmr::memory_resource *resource ) {
+            std::pmr::string res( "user-", resource );
+            res += obj.user;
+            res.append( 100, '.' ); // beyond SSO.
+            return res;
+        } )>();
+    }
+};
+} // namespace jz
+
+struct CountingResource : std::pmr::memory_resource
+{
+    std::pmr::memory_resource *upstream;
+    int                        allocations = 0;
+
+    explicit CountingResource( std::pmr::memory_resource *pupstream ) : upstream( pupstream ) {}
+    void *do_allocate( size_t bytes, size_t align ) override
+    {
+        ++allocations;
+        return upstream->allocate( bytes, align );
+    }
+    void do_deallocate( void *p, size_t bytes, size_t align ) override
+    {
+        upstream->deallocate( p, bytes, align );
+    }
+    bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+TEST_CASE( "formatstruct - pmr" )
+{
+    std::vector<Session> sessions = { { 1, "John" }, { 2, "Bob" } };
+    std::string          expected = jz::stringify_struct( sessions );
+
+    char                                arena[4096];
+    std::pmr::monotonic_buffer_resource monotonic( arena, sizeof( arena ), std::pmr::null_memory_resource() );
+    CountingResource                    counting( &monotonic );
+
+    std::pmr::string res = jz::stringify_struct( sessions, &counting );
+    CHECK_EQ( std::string_view( res ), expected );
+    CHECK_EQ( res.get_allocator().resource(), &counting );
+    CHECK_EQ( counting.allocations, 1 + 2 ); // output reserved once, each getter result allocated once.
+}
+
+TEST_CASE( "formatstruct - stringify_struct_pooled" )
+{
+    std::vector<Session> sessions( 10, Session{ 1, "John" } );
+    std::string          expected = jz::stringify_struct( sessions );
+
+    const char *data = nullptr;
+    {
+        auto res = jz::stringify_struct_pooled( sessions );
+        CHECK_EQ( res.view(), expected );
+        data = res.c_str();
+    }
+    CHECK_EQ( jz::StringPool::pooled(), 1 );
+    for ( int i = 0; i < 10; ++i )
+    {
+        auto res = jz::stringify_struct_pooled( sessions );
+        CHECK_EQ( res.view(), expected );
+        CHECK_EQ( res.c_str(), data ); // same buffer reused
+        CHECK_EQ( jz::StringPool::pooled(), 0 );
+    }
+    {
+        auto huge = jz::stringify_struct_pooled( std::vector<Session>( 1000, Session{ 1, "John" } ) );
+        CHECK_GT( huge.str().capacity(), jz::StringPool::MAX_POOLED_CAPACITY );
+    }
+    CHECK_EQ( jz::StringPool::pooled(), 0 ); // oversized buffer is freed.
+}
+
+enum class Side : int8_t
+{
+    Buy,
+    Sell,
+};
+struct Level
+{
+    Side                   side;
+    int64_t                price;
+    std::array<int32_t, 3> sizes;
+    std::variant<int, Color> tag;
+};
+
+TEST_CASE( "formatstruct - FormattedString" )
+{
+    constexpr size_t bound = jz::formatted_size_bound<Level, jz::JsonCompactGrammar>();
+    constexpr std::string_view longest =
+            R"({"side":"Sell","price":-9223372036854775808,"sizes":[-2147483648,-2147483648,-2147483648],"tag":-2147483648})";
+    static_assert( bound >= longest.size() );
+    static_assert( jz::formatted_size_bound<Account, jz::JsonSpacedGrammar>() > 0 );
+    static_assert( jz::formatted_size_bound<A>() == 0 );
+    static_assert( jz::formatted_size_bound<Quote>() == 0 );
+
+    Level level{ .side = Side::Sell, .price = INT64_MIN, .sizes = { INT32_MIN, INT32_MIN, INT32_MIN }, .tag = INT32_MIN };
+    auto  res = jz::stringify_struct<bound>( level, jz::jsonCompactContext );
+    CHECK( res.isInline() );
+    CHECK_EQ( res.view(), longest );
+    CHECK_EQ( res.view(), jz::stringify_struct( level, jz::jsonCompactContext ) );
+
+    level.tag   = Color::Black;
+    auto spaced = jz::stringify_struct<jz::formatted_size_bound<Level>()>( level );
+    CHECK( spaced.isInline() );
+    CHECK_EQ( spaced.view(), jz::stringify_struct( level ) );
+
+    auto spilled = jz::stringify_struct<16>( level );
+    CHECK_FALSE( spilled.isInline() );
+    CHECK_EQ( spilled.view(), jz::stringify_struct( level ) );
+    auto moved = std::move( spilled );
+    CHECK_EQ( moved.view(), jz::stringify_struct( level ) );
+    CHECK_EQ( spilled.size(), 0 );
+    auto copied = jz::stringify_struct<16>( Level{} );
+    spilled     = copied;
+    CHECK_EQ( spilled.view(), copied.view() );
+    moved = std::move( spilled );
+    CHECK_EQ( moved.view(), copied.view() );
+}
+
+struct Counters
+{
+    int16_t                  small;
+    uint32_t                 unsignedMax;
+    int64_t                  signedMin;
+    uint64_t                 unsignedBig;
+    std::map<int, uint16_t>  byKey;
+};
+
+TEST_CASE( "formatstruct - integers" )
+{
+    for( int64_t v : { INT64_MIN, INT64_MIN + 1, int64_t( -100 ), int64_t( -99 ), int64_t( -10 ), int64_t( -1 ), int64_t( 0 ), int64_t( 9 ),
+                       int64_t( 10 ), int64_t( 99 ), int64_t( 100 ), int64_t( 12345678901 ), INT64_MAX } )
+    {
+        char buf[jz::MAX_INTEGER_CHARS];
+        CHECK_EQ( std::string_view( buf, jz::formatDecimal( buf, v ) - buf ), std::to_string( v ) );
+    }
+    char buf[jz::MAX_INTEGER_CHARS];
+    CHECK_EQ( std::string_view( buf, jz::formatDecimal( buf, UINT64_MAX ) - buf ), std::to_string( UINT64_MAX ) );
+
+    Counters counters{ .small = INT16_MIN, .unsignedMax = UINT32_MAX, .signedMin = INT64_MIN, .unsignedBig = UINT64_MAX,
+                       .byKey = { { -7, 0 }, { 42, UINT16_MAX } } };
+    std::string_view expected = R"({"small":-32768,"unsignedMax":4294967295,"signedMin":-9223372036854775808,"unsignedBig":18446744073709551615,)"
+                                R"("byKey":{"-7":0,"42":65535}})";
+    CHECK_EQ( jz::stringify_struct( counters, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::stringify_struct<8>( counters, jz::jsonCompactContext ).view(), expected );
+    CHECK_EQ( jz::formatted_size( counters, jz::jsonCompactContext ), expected.size() );
+
+    // stream flags don't affect numbers
+    std::ostringstream oss;
+    oss << std::hex << std::showpos << jz::StructPrinter( counters, jz::jsonCompactContext );
+    CHECK_EQ( oss.str(), expected );
+}
+
+struct Trade
+{
+    double                price;
+    float                 qty;
+    double                fee;
+    std::vector<double>   fills;
+};
+
+template<>
+struct jz::FormatStructTrait<Trade>
+{
+    static constexpr int32_t FloatPrecision( std::string_view memberName )
+    {
+        return memberName == "price" ? 2 : memberName == "qty" ? 0 : CONTEXT_FLOAT_PRECISION;
+    }
+};
+
+TEST_CASE( "formatstruct - floats" )
+{
+    Quote q{ .price = 0.1 + 0.2, .qty = 1e20f, .tag = 'x', .level = 7, .sizes = {}, .parent = {} };
+    CHECK_EQ( jz::stringify_struct( q, jz::jsonCompactContext ), R"({"price":0.30000000000000004,"qty":1e+20,"tag":"x","level":7,"sizes":[],"parent":""})" );
+    for( double v : { 0.1, -123456.789, 1e-300, 5e-324, 1.7976931348623157e308, 100.0, 0.0, -0.0 } )
+    {
+        std::string out = jz::stringify_struct( Trade{ .price = 0, .qty = 0, .fee = v, .fills = {} }, jz::jsonCompactContext );
+        auto        pos = out.find( "\"fee\":" ) + 6;
+        CHECK_EQ( std::strtod( out.c_str() + pos, nullptr ), v );
+    }
+
+    Trade trade{ .price = 101.255, .qty = 2.5f, .fee = 0.125, .fills = { 1.5, 1e-7 } };
+    CHECK_EQ( jz::stringify_struct( trade, jz::jsonCompactContext ), R"({"price":101.25,"qty":2,"fee":0.125,"fills":[1.5,1e-07]})" );
+
+    jz::FormatContext<int, jz::JsonCompactGrammar> fixed;
+    fixed.floatPrecision = 3;
+    CHECK_EQ( jz::stringify_struct( trade, fixed ), R"({"price":101.25,"qty":2,"fee":0.125,"fills":[1.500,0.000]})" );
+    CHECK_EQ( jz::formatted_size( trade, fixed ), jz::stringify_struct( trade, fixed ).size() );
+    trade.fee = 1e300;
+    CHECK_EQ( jz::stringify_struct( trade, fixed ), R"({"price":101.25,"qty":2,"fee":1e+300,"fills":[1.500,0.000]})" );
+}
+
+struct Book
+{
+    int64_t  bid;
+    int64_t  ask;
+    uint32_t qty;
+    int32_t  level;
+};
+
+template<>
+struct jz::FormatStructTrait<Book>
+{
+    static constexpr uint32_t DecimalScale( std::string_view memberName ) { return memberName == "bid" || memberName == "ask" ? 4 : 0; }
+};
+
+TEST_CASE( "formatstruct - decimals" )
+{
+    auto print = []( auto dec ) { return jz::stringify_struct( dec, jz::jsonCompactContext ); };
+    CHECK_EQ( print( jz::Decimal<4>{ 1012500 } ), "101.2500" );
+    CHECK_EQ( print( jz::Decimal<4>{ -5 } ), "-0.0005" );
+    CHECK_EQ( print( jz::Decimal<3>{ -12345 } ), "-12.345" );
+    CHECK_EQ( print( jz::Decimal<1>{ 0 } ), "0.0" );
+    CHECK_EQ( print( jz::Decimal<0>{ -42 } ), "-42" );
+    CHECK_EQ( print( jz::Decimal<2, int32_t>{ INT32_MIN } ), "-21474836.48" );
+    CHECK_EQ( print( jz::Decimal<19, uint64_t>{ UINT64_MAX } ), "1.8446744073709551615" );
+    CHECK_EQ( print( jz::Decimal<19, int16_t>{ -1 } ), "-0.0000000000000000001" );
+    CHECK_EQ( print( jz::Decimal<18>{ INT64_MIN } ), "-9.223372036854775808" );
+
+    Book book{ .bid = 1012500, .ask = -1, .qty = 300, .level = -2 };
+    std::string_view expected = R"({"bid":101.2500,"ask":-0.0001,"qty":300,"level":-2})";
+    CHECK_EQ( jz::stringify_struct( book, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::stringify_struct<16>( book, jz::jsonCompactContext ).view(), expected );
+    CHECK_EQ( jz::formatted_size( book, jz::jsonCompactContext ), expected.size() );
+
+    book = Book{ .bid = INT64_MIN, .ask = INT64_MIN, .qty = UINT32_MAX, .level = INT32_MIN };
+    constexpr size_t bound = jz::formatted_size_bound<Book, jz::JsonCompactGrammar>();
+    CHECK_EQ( jz::stringify_struct( book, jz::jsonCompactContext ).size(), bound );
+    static_assert( jz::formatted_size_bound<jz::Decimal<19, int16_t>>() == 22 );
+
+    std::stringstream ss;
+    ss << jz::StructPrinter( book, jz::jsonCompactContext );
+    CHECK_EQ( ss.str(), jz::stringify_struct( book, jz::jsonCompactContext ) );
+}
+
+struct Event
+{
+    std::chrono::system_clock::time_point                                      at;
+    std::chrono::time_point<std::chrono::system_clock, std::chrono::seconds>  day;
+    std::chrono::nanoseconds                                                   latency;
+    std::chrono::milliseconds                                                  timeout;
+};
+
+TEST_CASE( "formatstruct - chrono" )
+{
+    using namespace std::chrono;
+    auto  at = sys_days{ 2024y / May / 17 } + 9h + 30min + 5s + 123456789ns;
+    Event event{ .at      = time_point_cast<system_clock::duration>( at ),
+                 .day     = time_point_cast<seconds>( sys_days{ 1969y / December / 31 } + 23h + 59min + 59s ),
+                 .latency = -1500ns,
+                 .timeout = 2500ms };
+    CHECK_EQ( jz::stringify_struct( event, jz::jsonCompactContext ),
+              R"({"at":"2024-05-17T09:30:05.123456789Z","day":"1969-12-31T23:59:59.000000000Z","latency":-0.000001500,"timeout":2.500000000})" );
+    CHECK_EQ( jz::formatted_size( event, jz::jsonCompactContext ), jz::stringify_struct( event, jz::jsonCompactContext ).size() );
+
+    jz::FormatContext<int, jz::KeyValueGrammar> ctx;
+    ctx.subsecondDigits = 3;
+    CHECK_EQ( jz::stringify_struct( event, ctx ), "{at=2024-05-17T09:30:05.123Z day=1969-12-31T23:59:59.000Z latency=0.000 timeout=2.500}" );
+    ctx.subsecondDigits = 0;
+    event.at += 24h;
+    CHECK_EQ( jz::stringify_struct( event, ctx ), "{at=2024-05-18T09:30:05Z day=1969-12-31T23:59:59Z latency=0 timeout=2}" );
+    ctx.timeFormat = jz::TimeFormat::EpochNanos;
+    CHECK_EQ( jz::stringify_struct( event, ctx ), "{at=1716024605123456789 day=-1000000000 latency=-1500 timeout=2500000000}" );
+
+    constexpr size_t bound = jz::formatted_size_bound<Event, jz::JsonCompactGrammar>();
+    CHECK( jz::stringify_struct<bound>( event, jz::jsonCompactContext ).isInline() );
+}
+
+struct Ladder
+{
+    std::vector<int>          sizes;
+    std::array<uint32_t, 3>   counts;
+    std::vector<uint8_t>      flags;
+    std::vector<int64_t>      prices;
+};
+
+TEST_CASE( "formatstruct - integer arrays" )
+{
+    Ladder ladder{ .sizes = {}, .counts = { 0, 10, UINT32_MAX }, .flags = { 0, 255 }, .prices = { INT64_MIN, -1, INT64_MAX } };
+    for( int i = 0; i < 5000; ++i )
+        ladder.sizes.push_back( ( i % 2 ? -1 : 1 ) * i * 997 );
+
+    std::string sizes;
+    for( size_t i = 0; i < ladder.sizes.size(); ++i )
+        sizes += ( i ? "," : "" ) + std::to_string( ladder.sizes[i] );
+    std::string expected = R"({"sizes":[)" + sizes + R"(],"counts":[0,10,4294967295],"flags":[0,255],"prices":[-9223372036854775808,-1,9223372036854775807]})";
+    CHECK_EQ( jz::stringify_struct( ladder, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( ladder, jz::jsonCompactContext ), expected.size() );
+
+    std::stringstream ss;
+    jz::format_struct( ss, ladder, jz::jsonCompactContext );
+    CHECK_EQ( ss.str(), expected );
+
+    std::vector<char> buf( 100 );
+    auto              res = jz::format_struct_into( buf.data(), buf.size(), ladder, jz::jsonCompactContext );
+    CHECK( res.truncated );
+    CHECK_EQ( std::string_view( buf.data(), res.size ).substr( 0, 40 ), std::string_view( expected ).substr( 0, 40 ) );
+
+    std::span<const int64_t> span( ladder.prices );
+    CHECK_EQ( jz::stringify_struct( span ), " [ -9223372036854775808 , -1 , 9223372036854775807 ] " );
+    CHECK_EQ( jz::stringify_struct( std::vector<int>{} ), " [  ] " );
+}
+
+struct Status
+{
+    uint32_t state : 12;
+    uint32_t mode : 4;
+    uint16_t flags;
+    uint64_t mask;
+    int32_t  code;
+    uint8_t  bits;
+};
+
+template<>
+struct jz::FormatStructTrait<Status>
+{
+    static constexpr std::string_view FLAG_NAMES[] = { "IOC", "PostOnly", "", "Hidden" };
+
+    static constexpr auto GetStructMembersTuple()
+    {
+        return jz::make_struct_members<BITFIELD_ACCESSOR( Status, state ), //
+                                       BITFIELD_ACCESSOR( Status, mode ),  //
+                                       &Status::flags,
+                                       &Status::mask,
+                                       &Status::code,
+                                       &Status::bits>();
+    }
+    static constexpr IntFormat IntegerFormat( std::string_view memberName )
+    {
+        if( memberName == "flags" )
+            return { IntFormat::NamedBits, FLAG_NAMES };
+        if( memberName == "mode" || memberName == "bits" )
+            return { IntFormat::Binary };
+        return { memberName == "code" ? IntFormat::Decimal : IntFormat::Hex };
+    }
+};
+
+TEST_CASE( "formatstruct - hex, binary and named bits" )
+{
+    Status status{ .state = 0xabc, .mode = 5, .flags = 0b1011, .mask = UINT64_MAX, .code = -1, .bits = 0x80 };
+    std::string_view expected =
+            R"({"state":"0xabc","mode":"0b101","flags":"IOC|PostOnly|Hidden","mask":"0xffffffffffffffff","code":-1,"bits":"0b10000000"})";
+    CHECK_EQ( jz::stringify_struct( status, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( status, jz::jsonCompactContext ), expected.size() );
+    std::stringstream ss;
+    jz::format_struct( ss, status, jz::jsonCompactContext );
+    CHECK_EQ( ss.str(), expected );
+
+    status = Status{ .state = 0, .mode = 1, .flags = 0b111100, .mask = 0x1234567, .code = 0, .bits = 0 };
+    CHECK_EQ( jz::stringify_struct( status, jz::keyValueContext ), "{mode=0b1 flags=Hidden|0x34 mask=0x1234567 code=0 bits=0b0}" );
+    status.flags = 0;
+    CHECK_EQ( jz::stringify_struct( status, jz::jsonCompactContext ), R"({"mode":"0b1","flags":"","mask":"0x1234567","code":0,"bits":"0b0"})" );
+
+    constexpr size_t bound = jz::formatted_size_bound<Status, jz::JsonCompactGrammar>();
+    status                 = Status{ .state = 0xfff, .mode = 0xf, .flags = 0xffff, .mask = UINT64_MAX, .code = INT32_MIN, .bits = 0xff };
+    CHECK( jz::stringify_struct<bound>( status, jz::jsonCompactContext ).isInline() );
+
+    char buf[jz::MAX_INTEGER_CHARS];
+    for( uint64_t v : std::initializer_list<uint64_t>{ 0, 1, 0xf, 0x10, 0xabcdef, UINT64_MAX } )
+    {
+        char hex[32];
+        std::snprintf( hex, sizeof( hex ), "0x%llx", (unsigned long long)v );
+        CHECK_EQ( std::string_view( buf, jz::formatHex( buf, v ) - buf ), hex );
+    }
+}
+
+enum class OrderFlags : uint16_t
+{
+    None     = 0,
+    IOC      = 1,
+    PostOnly = 2,
+    Hidden   = 8,
+    Iceberg  = 64
+};
+
+template<>
+struct jz::FormatStructTrait<OrderFlags>
+{
+    static constexpr bool IS_FLAGS = true;
+};
+
+struct NewOrder
+{
+    OrderFlags              flags;
+    Color                   color;
+    std::vector<OrderFlags> history;
+};
+
+TEST_CASE( "formatstruct - flag enums" )
+{
+    static_assert( jz::IsFlagEnum<OrderFlags> && !jz::IsFlagEnum<Color> );
+    NewOrder order{ .flags   = OrderFlags( 1 | 2 | 64 ),
+                    .color   = Color::Pink,
+                    .history = { OrderFlags::None, OrderFlags::Hidden, OrderFlags( 8 | 16 | 0x8000 ) } };
+    std::string_view expected = R"({"flags":"IOC|PostOnly|Iceberg","color":"Pink","history":["None","Hidden","Hidden|0x8010"]})";
+    CHECK_EQ( jz::stringify_struct( order, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( order, jz::jsonCompactContext ), expected.size() );
+    CHECK_EQ( jz::stringify_struct( order.flags, jz::keyValueContext ), "IOC|PostOnly|Iceberg" );
+
+    constexpr size_t bound = jz::formatted_size_bound<OrderFlags, jz::JsonCompactGrammar>();
+    static_assert( bound == std::string_view( R"("IOC|PostOnly|Hidden|Iceberg|0xffff")" ).size() );
+    CHECK_LE( jz::stringify_struct( OrderFlags( 0xffff ), jz::jsonCompactContext ).size(), bound );
+}
+
+enum class Venue : uint32_t
+{
+    XNAS = 0x53414e58, // "XNAS" little-endian
+    XNYS = 0x53594e58,
+    ARCX = 0x58435241,
+    BATS = 0x53544142
+};
+
+template<>
+struct jz::FormatStructTrait<Venue>
+{
+    static constexpr std::array<std::pair<Venue, std::string_view>, 4> EnumNames()
+    {
+        return { { { Venue::XNYS, "XNYS" }, { Venue::XNAS, "XNAS" }, { Venue::BATS, "BATS" }, { Venue::ARCX, "ARCX" } } };
+    }
+};
+
+enum class Gap : int16_t
+{
+    Low  = -100,
+    Zero = 0,
+    High = 100
+};
+
+struct Route
+{
+    Venue             venue;
+    Side              side;
+    Gap               gap;
+    std::vector<Venue> venues;
+};
+
+TEST_CASE( "formatstruct - enum name tables" )
+{
+    static_assert( jz::ENUM_NAMES<Color>.index.size() == 3 );      // dense
+    static_assert( jz::ENUM_NAMES<Venue>.index.size() == 0 );      // sparse
+    static_assert( jz::ENUM_NAMES<Venue>.quoted( Venue::ARCX ) == "\"ARCX\"" );
+    static_assert( jz::ENUM_NAMES<Gap>.quoted( Gap::Low ) == "\"Low\"" && jz::ENUM_NAMES<Gap>.quoted( Gap( 1 ) ).empty() );
+
+    Route route{ .venue = Venue::XNAS, .side = Side::Sell, .gap = Gap::High, .venues = { Venue::BATS, Venue( 7 ), Venue::XNYS } };
+    std::string_view expected = R"({"venue":"XNAS","side":"Sell","gap":"High","venues":["BATS",7,"XNYS"]})";
+    CHECK_EQ( jz::stringify_struct( route, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( route, jz::jsonCompactContext ), expected.size() );
+    route.gap = Gap( -5 );
+    CHECK_EQ( jz::stringify_struct( route, jz::keyValueContext ), "{venue=XNAS side=Sell gap=-5 venues=[BATS,7,XNYS]}" );
+    CHECK_EQ( jz::stringify_struct( std::map<std::string, Color>{ { "a", Color::Black } }, jz::jsonCompactContext ), R"({"a":"Black"})" );
+
+    route.venue = Venue( UINT32_MAX );
+    route.gap   = Gap( INT16_MIN );
+    std::vector<char> out( jz::formatted_size_bound<std::array<Venue, 1>, jz::JsonCompactGrammar>() );
+    CHECK_FALSE( jz::format_struct_into( out.data(), out.size(), std::array<Venue, 1>{ route.venue }, jz::jsonCompactContext ).truncated );
+    CHECK_FALSE( jz::format_struct_into( out.data(), out.size(), std::array<Gap, 1>{ route.gap }, jz::jsonCompactContext ).truncated );
+}
+
+struct Note
+{
+    std::string                        text;
+    char                               mark;
+    std::map<std::string, std::string> tags;
+};
+
+TEST_CASE( "formatstruct - json escaping" )
+{
+    Note note{ .text = "say \"hi\"\\\n\t\x01 ok", .mark = '"', .tags = { { "k\"ey", "v\x1f" } } };
+    std::string_view expected = R"({"text":"say \"hi\"\\\n\t\u0001 ok","mark":"\"","tags":{"k\"ey":"v\u001f"}})";
+    CHECK_EQ( jz::stringify_struct( note, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( note, jz::jsonCompactContext ), expected.size() );
+    CHECK_EQ( jz::stringify_struct( note.text, jz::keyValueContext ), note.text );
+
+    jz::FormatContext<> raw;
+    raw.grammar.escapeStrings = false;
+    CHECK_EQ( jz::stringify_struct( note.text, raw ), "\"" + note.text + "\"" );
+
+    // every position of an escaped char around the 16 and 32 byte blocks
+    for( size_t len : { 0, 1, 15, 16, 17, 31, 32, 33, 64, 100 } )
+    {
+        std::string clean( len, 'a' );
+        CHECK_EQ( jz::findJsonEscape( clean ), len );
+        CHECK_EQ( jz::stringify_struct( clean ), "\"" + clean + "\"" );
+        for( size_t i = 0; i < len; ++i )
+        {
+            for( char c : { '"', '\\', '\0', '\x1f', '\x7f' } )
+            {
+                std::string s = clean;
+                s[i]          = c;
+                CHECK_EQ( jz::findJsonEscape( s ), c == '\x7f' ? len : i );
+            }
+        }
+    }
+    std::string utf8 = "caf\xc3\xa9 \xe2\x82\xac";
+    CHECK_EQ( jz::findJsonEscape( utf8 ), utf8.size() );
+}
+
+TEST_CASE( "formatstruct - utf8 policy" )
+{
+    std::string valid = "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \"q\"";
+    Note        note{ .text = "ok \xff" + valid + "\xc3", .mark = '\xfe', .tags = { { "k\xc0\xaf", "\xed\xa0\x80" } } };
+
+    jz::FormatContext<int, jz::JsonCompactGrammar> ctx;
+    CHECK_EQ( jz::stringify_struct( note, ctx ),
+              "{\"text\":\"ok \xff" + valid.substr( 0, valid.size() - 3 ) + "\\\"q\\\"\xc3\",\"mark\":\"\xfe\",\"tags\":{\"k\xc0\xaf\":\"\xed\xa0\x80\"}}" );
+
+    ctx.utf8Policy = jz::Utf8Policy::Replace;
+    std::string out = jz::stringify_struct( note, ctx );
+    CHECK_EQ( out, "{\"text\":\"ok \xef\xbf\xbd" + valid.substr( 0, valid.size() - 3 ) + "\\\"q\\\"\xef\xbf\xbd\",\"mark\":\"\xef\xbf\xbd\","
+                   "\"tags\":{\"k\xef\xbf\xbd\xef\xbf\xbd\":\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\"}}" );
+    CHECK_EQ( jz::formatted_size( note, ctx ), out.size() );
+
+    ctx.utf8Policy = jz::Utf8Policy::HexEscape;
+    CHECK_EQ( jz::stringify_struct( note, ctx ), "{\"text\":\"ok \\\\xff" + valid.substr( 0, valid.size() - 3 ) + "\\\"q\\\"\\\\xc3\",\"mark\":\"\\\\xfe\","
+                                                 "\"tags\":{\"k\\\\xc0\\\\xaf\":\"\\\\xed\\\\xa0\\\\x80\"}}" );
+    jz::FormatContext<int, jz::KeyValueGrammar> kv;
+    kv.utf8Policy = jz::Utf8Policy::HexEscape;
+    CHECK_EQ( jz::stringify_struct( note.text, kv ), "ok \\xff" + valid + "\\xc3" );
+
+    // valid text across the 16 and 32 byte blocks is copied unchanged
+    std::string longText;
+    for( int i = 0; i < 20; ++i )
+        longText += valid.substr( 0, valid.size() - 4 );
+    kv.utf8Policy = jz::Utf8Policy::Replace;
+    CHECK_EQ( jz::stringify_struct( longText, kv ), longText );
+    CHECK_EQ( jz::validUtf8Length( "\xf4\x90\x80\x80" ), 0 ); // above U+10FFFF
+    CHECK_EQ( jz::validUtf8Length( "\xe0\x80\xaf" ), 0 );     // overlong
+    CHECK_EQ( jz::validUtf8Length( "\xf4\x8f\xbf\xbf" ), 4 );
+#if defined( __SSSE3__ )
+    size_t blocks = jz::validUtf8Blocks<true>( longText ); // whole blocks ending on a code point boundary.
+    CHECK_GT( blocks, 0 );
+    CHECK_EQ( blocks % 16, 0 );
+    CHECK_LE( blocks, longText.size() );
+    CHECK_EQ( jz::validUtf8Blocks<true>( "\"" + longText ), 0 );
+#endif
+}
+
+TEST_CASE( "formatstruct - utf8 policy on mixed blocks" )
+{
+    const std::vector<std::string> pieces = { "a",        "xyz ",     "\"",          "\n",          "\xc3\xa9",       "\xe2\x82\xac",
+                                              "\xe4\xb8\xad", "\xf0\x9f\x98\x80", "\xff",          "\x80",         "\xc3",           "\xe2\x82",
+                                              "\xed\xa0\x80", "\xe0\x80\xaf", "\xf4\x90\x80\x80", "\xc0\xaf" };
+    std::mt19937 rng( 7 );
+    jz::FormatContext<int, jz::JsonCompactGrammar> ctx;
+    ctx.utf8Policy = jz::Utf8Policy::Replace;
+    for ( int round = 0; round < 500; ++round )
+    {
+        std::string text;
+        size_t      validPieces = 8 - round % 9; // mostly valid text, with fewer invalid pieces in the mix.
+        while ( text.size() < 100 )
+            text += pieces[rng() % ( rng() % 8 < validPieces ? 8 : pieces.size() )];
+
+        std::string expected = "\"";
+        for ( size_t i = 0; i < text.size(); )
+        {
+            uint8_t c = uint8_t( text[i] );
+            if ( c < 0x80 )
+            {
+                if ( char esc = jz::JSON_ESCAPES[c] )
+                    expected += std::string( "\\" ) + esc;
+                else
+                    expected += text[i];
+                ++i;
+            }
+            else if ( size_t n = jz::validUtf8Length( std::string_view( text ).substr( i ) ) )
+            {
+                expected += text.substr( i, n );
+                i += n;
+            }
+            else
+            {
+                expected += "\xef\xbf\xbd";
+                ++i;
+            }
+        }
+        expected += "\"";
+        CHECK_EQ( jz::stringify_struct( text, ctx ), expected );
+    }
+}
+
+struct Packed
+{
+    uint8_t a : 4;
+    uint8_t b : 4;
+    int8_t  c : 5;
+};
+
+template<>
+struct jz::FormatStructTrait<Packed>
+{
+    static constexpr auto GetStructMembersTuple()
+    {
+        return jz::make_struct_members<BITFIELD_ACCESSOR( Packed, a ), BITFIELD_ACCESSOR( Packed, b ), BITFIELD_ACCESSOR( Packed, c )>();
+    }
+};
+
+TEST_CASE( "formatstruct - uint8_t bitfields" )
+{
+    Packed           packed{ .a = 3, .b = 15, .c = -16 };
+    std::string_view expected = R"({"a":3,"b":15,"c":-16})";
+    CHECK_EQ( jz::stringify_struct( packed, jz::jsonCompactContext ), expected );
+    CHECK_EQ( jz::formatted_size( packed, jz::jsonCompactContext ), expected.size() );
+    CHECK_LE( expected.size(), jz::formatted_size_bound<Packed, jz::JsonCompactGrammar>() );
+    std::stringstream ss;
+    jz::format_struct( ss, packed, jz::jsonCompactContext );
+    CHECK_EQ( ss.str(), expected );
+}
+
+enum class BigFlags : uint32_t
+{
+    A = 1,
+    B = 2,
+    C = 128,
+    D = 256,
+    E = 0x80000000
+};
+
+template<>
+struct jz::FormatStructTrait<BigFlags>
+{
+    static constexpr bool IS_FLAGS = true;
+    static constexpr std::array<std::pair<BigFlags, std::string_view>, 5> EnumNames()
+    {
+        return { { { BigFlags::A, "A" }, { BigFlags::B, "B" }, { BigFlags::C, "C" }, { BigFlags::D, "D" }, { BigFlags::E, "E" } } };
+    }
+};
+
+TEST_CASE( "formatstruct - flag enums above bit 7" )
+{
+    CHECK_EQ( jz::stringify_struct( BigFlags::C, jz::jsonCompactContext ), R"("C")" );
+    CHECK_EQ( jz::stringify_struct( BigFlags( 1 | 128 | 256 ), jz::jsonCompactContext ), R"("A|C|D")" );
+    CHECK_EQ( jz::stringify_struct( BigFlags( 0x80000000 | 0x400 | 2 ), jz::jsonCompactContext ), R"("B|E|0x400")" );
+    CHECK_EQ( jz::stringify_struct( BigFlags( 0 ), jz::jsonCompactContext ), R"("")" );
+}